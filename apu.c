@@ -0,0 +1,901 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apu.h"
+#include "machine.h"
+
+#if !defined(NEMU_SCALAR) && defined(__SSE2__)
+#include <emmintrin.h>
+#define APUSSE2
+#endif
+
+#define APUHZ 1789773.0    // ntsc cpu clock
+
+// the mix, linear. close enough to the real one below full volume.
+#define PULSEVOL    0.00752f
+#define TRIANGLEVOL 0.00851f
+#define NOISEVOL    0.00494f
+#define DMCVOL      0.00335f
+
+#define ONE    (1ull << 32)    // of audio->pos and step
+#define WAVHDR 44
+
+static const uint8_t lengths[32] = {
+	10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+	12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+static const uint8_t duties[4] = { 0x02, 0x06, 0x1E, 0xF9 };    // bit n is step n
+
+static const uint16_t noiseperiods[16] = {
+	4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068,
+};
+
+static const uint16_t dmcperiods[16] = {
+	428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54,
+};
+
+// the frame sequencer's clocks, cpu cycles into the sequence, and what
+// they clock. the 4 step sequence ends on the frame irq.
+static const uint16_t seqsteps[2][5] = {
+	{ 7457, 14913, 22371, 29829 },
+	{ 7457, 14913, 22371, 29829, 37281 },
+};
+static const uint16_t seqlength[2] = { APUFRAME, 37282 };
+static const uint8_t seqcount[2] = { 4, 5 };
+static const uint8_t seqhalf[2][5] = {
+	{ 0, 1, 0, 1 },
+	{ 0, 1, 0, 0, 1 },
+};
+static const uint8_t seqquarter[2][5] = {
+	{ 1, 1, 1, 1 },
+	{ 1, 1, 1, 0, 1 },
+};
+
+
+// a step of d in the output at clock, split between the two slots either
+// side of it
+static void delta(struct audio *a, uint64_t clock, float d)
+{
+	uint64_t at = clock - a->base;
+	float *p = a->buf + AUDIOTAPS + at / AUDIODIV;
+	float f = (float)(at % AUDIODIV) / AUDIODIV;
+
+	p[0] += d * (1 - f);
+	p[1] += d * f;
+}
+
+
+// set a channel's output at clock, its step goes in the delta buffer
+static void output(struct nemu_machine *m, uint8_t *out, uint8_t level, float vol, uint64_t clock)
+{
+	if (level == *out)
+		return;
+	if (m->audio)
+		delta(m->audio, clock, ((int)level - *out) * vol);
+	*out = level;
+}
+
+
+static uint8_t volume(uint8_t ctrl, const struct apuenvelope *env)
+{
+	return ctrl & 0x10 ? ctrl & 0x0F : env->decay;
+}
+
+
+// pulse 1 negates in ones' complement, pulse 2 in two's
+static int sweeptarget(const struct apupulse *p, int n)
+{
+	int change = p->period >> (p->sweep & 7);
+
+	if (!(p->sweep & 0x08))
+		return p->period + change;
+	return p->period - change - (n == 0);
+}
+
+
+// the sweep mutes on the target overflowing, whether or not it is enabled
+static _Bool pulsemuted(const struct apupulse *p, int n)
+{
+	return !p->length || p->period < 8 || sweeptarget(p, n) > 0x7FF;
+}
+
+
+static uint8_t pulselevel(const struct apupulse *p, int n)
+{
+	if (pulsemuted(p, n))
+		return 0;
+	return duties[p->ctrl >> 6] >> p->step & 1 ? volume(p->ctrl, &p->env) : 0;
+}
+
+
+static uint8_t trianglelevel(const struct aputriangle *t)
+{
+	return t->step < 16 ? 15 - t->step : t->step - 16;
+}
+
+
+static uint8_t noiselevel(const struct apunoise *z)
+{
+	return z->length && !(z->lfsr & 1) ? volume(z->ctrl, &z->env) : 0;
+}
+
+
+static float mix(const struct apu *a)
+{
+	return (a->pulse[0].out + a->pulse[1].out) * PULSEVOL + a->triangle.out * TRIANGLEVOL +
+	       a->noise.out * NOISEVOL + a->dmc.level * DMCVOL;
+}
+
+
+// a timer that can't change the output is only moved along, by steps of
+// period to the first at or past until
+static uint64_t skip(uint64_t *next, uint64_t until, uint64_t period)
+{
+	uint64_t n = (until - *next + period - 1) / period;
+
+	*next += n * period;
+	return n;
+}
+
+
+// the channels' timers from where they are up to until, with no register
+// writes or frame sequencer clocks in between. without an audio sink
+// nothing is heard and they are only moved along.
+static void tones(struct nemu_machine *m, uint64_t until)
+{
+	struct apu *a = &m->apu;
+
+	for (int i = 0; i < 2; i++) {
+		struct apupulse *p = &a->pulse[i];
+		uint64_t period = (p->period + 1) * 2;
+
+		if (p->next >= until)
+			continue;
+		if (!m->audio || pulsemuted(p, i) || !volume(p->ctrl, &p->env)) {
+			p->step = (p->step + skip(&p->next, until, period)) & 7;
+			p->out = pulselevel(p, i);
+			continue;
+		}
+		for (; p->next < until; p->next += period) {
+			p->step = (p->step + 1) & 7;
+			output(m, &p->out, pulselevel(p, i), PULSEVOL, p->next);
+		}
+	}
+
+	// ultrasonic periods hold where they are rather than buzz
+	struct aputriangle *t = &a->triangle;
+	_Bool running = t->length && t->linear && t->period >= 2;
+
+	if (t->next < until && (!m->audio || !running)) {
+		uint64_t n = skip(&t->next, until, t->period + 1);
+
+		if (running)
+			t->step = (t->step + n) & 31;
+		t->out = trianglelevel(t);
+	}
+	for (; t->next < until; t->next += t->period + 1) {
+		t->step = (t->step + 1) & 31;
+		output(m, &t->out, trianglelevel(t), TRIANGLEVOL, t->next);
+	}
+
+	// the shift register always runs, it is cheap and what it holds
+	// shouldn't depend on whether anyone listened
+	struct apunoise *z = &a->noise;
+	uint64_t period = noiseperiods[z->mode & 0x0F];
+	_Bool heard = m->audio && z->length && volume(z->ctrl, &z->env);
+
+	for (; z->next < until; z->next += period) {
+		uint16_t bit = (z->lfsr ^ z->lfsr >> (z->mode & 0x80 ? 6 : 1)) & 1;
+
+		z->lfsr = z->lfsr >> 1 | bit << 14;
+		if (heard)
+			output(m, &z->out, noiselevel(z), NOISEVOL, z->next);
+	}
+	z->out = noiselevel(z);
+
+	// the dmc's bits, from the bytes its reader logged
+	struct apudmc *d = &a->dmc;
+
+	for (; d->bits && d->next < until; d->next += dmcperiods[d->rate]) {
+		uint8_t level = d->level;
+
+		if (d->shift & 1)
+			level += level <= 125 ? 2 : 0;
+		else
+			level -= level >= 2 ? 2 : 0;
+		d->shift >>= 1;
+		d->bits--;
+		output(m, &d->level, level, DMCVOL, d->next);
+	}
+}
+
+
+static void envelope(uint8_t ctrl, struct apuenvelope *e)
+{
+	if (e->start) {
+		e->start = 0;
+		e->decay = 15;
+		e->divider = ctrl & 0x0F;
+	} else if (e->divider) {
+		e->divider--;
+	} else {
+		e->divider = ctrl & 0x0F;
+		if (e->decay)
+			e->decay--;
+		else if (ctrl & 0x20)
+			e->decay = 15;
+	}
+}
+
+
+static void quarter(struct apu *a)
+{
+	struct aputriangle *t = &a->triangle;
+
+	envelope(a->pulse[0].ctrl, &a->pulse[0].env);
+	envelope(a->pulse[1].ctrl, &a->pulse[1].env);
+	envelope(a->noise.ctrl, &a->noise.env);
+
+	if (t->reload)
+		t->linear = t->ctrl & 0x7F;
+	else if (t->linear)
+		t->linear--;
+	if (!(t->ctrl & 0x80))
+		t->reload = 0;
+}
+
+
+static void half(struct apu *a)
+{
+	for (int i = 0; i < 2; i++) {
+		struct apupulse *p = &a->pulse[i];
+		int target = sweeptarget(p, i);
+
+		if (!(p->ctrl & 0x20) && p->length)
+			p->length--;
+
+		if (!p->sweepdivider && (p->sweep & 0x80) && (p->sweep & 7) && !pulsemuted(p, i))
+			p->period = target;
+		if (!p->sweepdivider || p->sweepreload) {
+			p->sweepdivider = p->sweep >> 4 & 7;
+			p->sweepreload = 0;
+		} else {
+			p->sweepdivider--;
+		}
+	}
+
+	if (!(a->triangle.ctrl & 0x80) && a->triangle.length)
+		a->triangle.length--;
+	if (!(a->noise.ctrl & 0x20) && a->noise.length)
+		a->noise.length--;
+}
+
+
+// what a register write or a frame sequencer clock at clock changed about
+// the outputs
+static void levels(struct nemu_machine *m, uint64_t clock)
+{
+	struct apu *a = &m->apu;
+
+	output(m, &a->pulse[0].out, pulselevel(&a->pulse[0], 0), PULSEVOL, clock);
+	output(m, &a->pulse[1].out, pulselevel(&a->pulse[1], 1), PULSEVOL, clock);
+	output(m, &a->noise.out, noiselevel(&a->noise), NOISEVOL, clock);
+}
+
+
+// a logged write as the batch gets to it
+static void apply(struct nemu_machine *m, uint8_t reg, uint8_t data, uint64_t clock)
+{
+	struct apu *a = &m->apu;
+	struct apupulse *p = &a->pulse[reg >> 2 & 1];
+	struct aputriangle *t = &a->triangle;
+	struct apunoise *z = &a->noise;
+
+	switch (reg) {
+	case 0x00:
+	case 0x04:
+		p->ctrl = data;
+		break;
+	case 0x01:
+	case 0x05:
+		p->sweep = data;
+		p->sweepreload = 1;
+		break;
+	case 0x02:
+	case 0x06:
+		p->period = (p->period & 0x700) | data;
+		break;
+	case 0x03:
+	case 0x07:
+		p->period = (p->period & 0xFF) | (data & 7) << 8;
+		if (a->enable & (1 << (reg >> 2)))
+			p->length = lengths[data >> 3];
+		p->step = 0;
+		p->env.start = 1;
+		break;
+	case 0x08:
+		t->ctrl = data;
+		break;
+	case 0x0A:
+		t->period = (t->period & 0x700) | data;
+		break;
+	case 0x0B:
+		t->period = (t->period & 0xFF) | (data & 7) << 8;
+		if (a->enable & 0x04)
+			t->length = lengths[data >> 3];
+		t->reload = 1;
+		break;
+	case 0x0C:
+		z->ctrl = data;
+		break;
+	case 0x0E:
+		z->mode = data;
+		break;
+	case 0x0F:
+		if (a->enable & 0x08)
+			z->length = lengths[data >> 3];
+		z->env.start = 1;
+		break;
+	case 0x10:
+		a->dmc.rate = data & 0x0F;
+		break;
+	case 0x11:
+		output(m, &a->dmc.level, data & 0x7F, DMCVOL, clock);
+		break;
+	case 0x15:
+		a->enable = data;
+		for (int i = 0; i < 2; i++) {
+			if (!(data & (1 << i)))
+				a->pulse[i].length = 0;
+		}
+		if (!(data & 0x04))
+			t->length = 0;
+		if (!(data & 0x08))
+			z->length = 0;
+		break;
+	case 0x17:
+		a->mode = data >> 7;
+		a->seqstart = clock;
+		a->seqstep = 0;
+		if (a->mode) {
+			quarter(a);
+			half(a);
+		}
+		break;
+	case APUDMCBYTE:
+		a->dmc.shift = data;
+		a->dmc.bits = 8;
+		a->dmc.next = clock;
+		break;
+	}
+
+	levels(m, clock);
+}
+
+
+static uint64_t seqnext(const struct apu *a)
+{
+	return a->seqstart + seqsteps[a->mode][a->seqstep];
+}
+
+
+// run the batch to until, applying the log from entry i on. returns the
+// first entry it didn't get to.
+static size_t batch(struct nemu_machine *m, uint64_t until, size_t i)
+{
+	struct apu *a = &m->apu;
+
+	for (;;) {
+		const struct apuwrite *w = i < m->apulogn ? &m->apulog[i] : NULL;
+		uint64_t at = w && w->clock > a->clock ? w->clock : a->clock;
+		uint64_t seq = seqnext(a);
+		uint64_t next = until;
+
+		if (seq < next)
+			next = seq;
+		if (w && at <= next)
+			next = at;
+
+		tones(m, next);
+		a->clock = next;
+
+		if (w && at == next) {
+			apply(m, w->reg, w->data, next);
+			i++;
+		} else if (seq == next) {
+			if (seqquarter[a->mode][a->seqstep])
+				quarter(a);
+			if (seqhalf[a->mode][a->seqstep])
+				half(a);
+			if (++a->seqstep == seqcount[a->mode]) {
+				a->seqstep = 0;
+				a->seqstart += seqlength[a->mode];
+			}
+			levels(m, next);
+		} else {
+			return i;
+		}
+	}
+}
+
+
+static float dot(const float *x, const float *k)
+{
+#ifdef APUSSE2
+	__m128 s = _mm_setzero_ps();
+
+	for (int t = 0; t < AUDIOTAPS; t += 4)
+		s = _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(x + t), _mm_loadu_ps(k + t)));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+#else
+	float s = 0;
+
+	for (int t = 0; t < AUDIOTAPS; t++)
+		s += x[t] * k[t];
+	return s;
+#endif
+}
+
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+
+// the ring into the wav, if there is one
+static void drain(struct audio *a)
+{
+	uint8_t out[2 * 256];
+	size_t n = 0;
+
+	if (!a->wav)
+		return;
+
+	while (a->count) {
+		put16(out + n * 2, a->ring[a->head]);
+		a->head = (a->head + 1) % AUDIORING;
+		a->count--;
+		if (++n == sizeof(out) / 2 || !a->count) {
+			if (fwrite(out, 2, n, a->wav) != n && !a->err)
+				a->err = errno ? errno : EIO;
+			a->written += n;
+			n = 0;
+		}
+	}
+}
+
+
+// integrate the slots the batch is done with and filter the samples that
+// fall among them out of the levels, then move the rest down
+static void resample(struct audio *a)
+{
+	size_t n = (a->clock - a->base) / AUDIODIV;
+	float *x = a->buf + AUDIOTAPS;
+	float level = a->level;
+
+	if (!n)
+		return;
+
+	for (size_t i = 0; i < n; i++) {
+		level += x[i];
+		x[i] = level;
+	}
+	a->level = level;
+
+	// a sample at pos takes the taps around it, all of them integrated
+	for (size_t i; (i = a->pos >> 32) + AUDIOTAPS / 2 < AUDIOTAPS + n; a->pos += a->step) {
+		float y = dot(a->buf + i - AUDIOTAPS / 2 + 1, a->kernel[(uint32_t)a->pos >> 26]);
+		float out = y - a->dcin + a->dc * a->dcout;
+		float s = out * 32767;
+
+		a->dcin = y;
+		a->dcout = out;
+		a->ring[(a->head + a->count) % AUDIORING] = s > 32767 ? 32767 : s < -32768 ? -32768 : (int16_t)s;
+		if (a->count < AUDIORING)
+			a->count++;
+		else
+			a->head = (a->head + 1) % AUDIORING;
+	}
+	drain(a);
+
+	memmove(a->buf, a->buf + n, (AUDIOTAPS + 2) * sizeof(float));
+	memset(a->buf + AUDIOTAPS + 2, 0, AUDIOSLOTS * sizeof(float));
+	a->pos -= (uint64_t)n << 32;
+	a->base += n * AUDIODIV;
+}
+
+
+// start the sink afresh where the apu is, after attaching it or the
+// machine going back in time
+static void audioreset(struct audio *a, const struct apu *apu)
+{
+	memset(a->buf, 0, sizeof(a->buf));
+	a->base = a->clock = apu->clock;
+	a->pos = (uint64_t)(AUDIOTAPS / 2) << 32;
+	a->level = mix(apu);
+	for (int i = 0; i < AUDIOTAPS; i++)
+		a->buf[i] = a->level;
+	a->dcin = a->level;
+	a->dcout = 0;
+}
+
+
+void apusync(struct nemu_machine *m)
+{
+	struct apu *a = &m->apu;
+	struct audio *s = m->audio;
+	uint64_t now = m->cpu.clock_count;
+	size_t i = 0;
+
+	if (!a->on)
+		return;
+
+	if (s && s->clock != a->clock)
+		audioreset(s, a);
+
+	while (a->clock < now || i < m->apulogn) {
+		uint64_t until = now;
+
+		// as far as the delta buffer reaches
+		if (s && until > s->base + AUDIOSLOTS * AUDIODIV - 1)
+			until = s->base + AUDIOSLOTS * AUDIODIV - 1;
+		i = batch(m, until, i);
+		if (s) {
+			s->clock = a->clock;
+			resample(s);
+		}
+		if (a->clock == now)
+			break;
+	}
+
+	m->apulogn -= i;
+	memmove(m->apulog, m->apulog + i, m->apulogn * sizeof(*m->apulog));
+}
+
+
+static void record(struct nemu_machine *m, uint8_t reg, uint8_t data, uint64_t clock)
+{
+	if (m->apulogn == APULOG)
+		apusync(m);
+	m->apulog[m->apulogn++] = (struct apuwrite){ clock, reg, data };
+}
+
+
+// the dmc's memory reader, run on time. the output unit takes a byte out
+// of the buffer every 8 bits and the reader fetches the next.
+
+static uint32_t dmccycle(const struct apudmc *d)
+{
+	return dmcperiods[d->ctrl & 0x0F] * 8;
+}
+
+
+static void dmcrestart(struct apudmc *d)
+{
+	d->addr = 0xC000 | d->start << 6;
+	d->left = d->len * 16 + 1;
+}
+
+
+static void dmcfetch(struct nemu_machine *m)
+{
+	struct apudmc *d = &m->apu.dmc;
+
+	// the cpu gives up the bus for it, 4 cycles as a rule. 3 when it lands
+	// on a write and 2 in a sprite dma aren't told apart.
+	d->buf = busread(m, d->addr, 0);
+	d->full = 1;
+	cpustall(m, 4, 0);
+	d->addr = d->addr == 0xFFFF ? 0x8000 : d->addr + 1;
+
+	if (--d->left)
+		return;
+	if (d->ctrl & 0x40) {
+		dmcrestart(d);
+	} else if (d->ctrl & 0x80) {
+		m->apu.dmcirq = 1;
+		cpuirqline(m, IRQDMC, 1);
+	}
+}
+
+
+static void dmcrun(struct nemu_machine *m, uint64_t now)
+{
+	struct apudmc *d = &m->apu.dmc;
+	uint32_t cycle = dmccycle(d);
+
+	while (d->clock + cycle <= now) {
+		// nothing to play, the unit goes round silent
+		if (!d->full) {
+			d->clock += (now - d->clock) / cycle * cycle;
+			break;
+		}
+
+		d->clock += cycle;
+		d->full = 0;
+		record(m, APUDMCBYTE, d->buf, d->clock);
+		if (d->left)
+			dmcfetch(m);
+	}
+}
+
+
+// the next thing the cpu has to hear about: the frame irq, the dmc
+// fetching, and a batch every frame to keep the log short and an audio
+// sink fed
+void apuschedule(struct nemu_machine *m)
+{
+	struct apu *a = &m->apu;
+	uint64_t when = a->irqat;
+
+	if (a->dmc.full && a->dmc.clock + dmccycle(&a->dmc) < when)
+		when = a->dmc.clock + dmccycle(&a->dmc);
+	if (a->synthat < when)
+		when = a->synthat;
+
+	schedat(m, SCHEDAPU, when);
+}
+
+
+// irqat is cleared by an inhibit or the five step mode, and a looping
+// sample never ends
+_Bool apucanirq(struct nemu_machine *m)
+{
+	const struct apu *a = &m->apu;
+
+	if (!a->on)
+		return 0;
+
+	return a->irqat != UINT64_MAX || ((a->dmc.ctrl & 0xC0) == 0x80 && a->dmc.left);
+}
+
+
+void apuevent(struct nemu_machine *m)
+{
+	struct apu *a = &m->apu;
+	uint64_t now = m->cpu.clock_count;
+
+	dmcrun(m, now);
+
+	if (now >= a->irqat) {
+		a->frameirq = 1;
+		cpuirqline(m, IRQFRAME, 1);
+		a->irqat += (now - a->irqat) / APUFRAME * APUFRAME + APUFRAME;
+	}
+
+	if (now >= a->synthat) {
+		apusync(m);
+		a->synthat = now + APUFRAME;
+	}
+
+	apuschedule(m);
+}
+
+
+static uint8_t regread(struct nemu_machine *m, uint16_t addr)
+{
+	struct apu *a = &m->apu;
+	uint8_t data;
+
+	if (addr == 0x4016 || addr == 0x4017)
+		return inputread(m, addr);
+	if (addr != 0x4015)
+		return 0x40;    // open bus, usually the high byte of the address
+
+	dmcrun(m, m->cpu.clock_count);
+	apusync(m);
+	data = (a->pulse[0].length ? 0x01 : 0) | (a->pulse[1].length ? 0x02 : 0) |
+	       (a->triangle.length ? 0x04 : 0) | (a->noise.length ? 0x08 : 0) |
+	       (a->dmc.left ? 0x10 : 0) | a->frameirq << 6 | a->dmcirq << 7;
+	a->frameirq = 0;
+	cpuirqline(m, IRQFRAME, 0);
+
+	return data;
+}
+
+
+static void regwrite(struct nemu_machine *m, uint16_t addr, uint8_t data)
+{
+	struct apu *a = &m->apu;
+	struct apudmc *d = &a->dmc;
+	uint64_t now = m->cpu.clock_count;
+
+	switch (addr) {
+	case 0x4010:
+		dmcrun(m, now);
+		d->ctrl = data;
+		if (!(data & 0x80)) {
+			a->dmcirq = 0;
+			cpuirqline(m, IRQDMC, 0);
+		}
+		break;
+	case 0x4012:
+		d->start = data;
+		return;
+	case 0x4013:
+		d->len = data;
+		return;
+	case 0x4015:
+		dmcrun(m, now);
+		a->dmcirq = 0;
+		cpuirqline(m, IRQDMC, 0);
+		if (!(data & 0x10)) {
+			d->left = 0;
+		} else if (!d->left) {
+			dmcrestart(d);
+			if (!d->full)
+				dmcfetch(m);
+		}
+		break;
+	case 0x4014:
+		ppudma(m, data);
+		return;
+	case 0x4016:
+		inputwrite(m, addr, data);
+		return;
+	case 0x4017:
+		a->inhibit = data >> 6 & 1;
+		if (a->inhibit) {
+			a->frameirq = 0;
+			cpuirqline(m, IRQFRAME, 0);
+		}
+		a->irqat = data & 0xC0 ? UINT64_MAX : now + seqsteps[0][3];
+		break;
+	default:
+		// the rest of the page is open bus
+		if (addr > 0x4017)
+			return;
+	}
+
+	record(m, addr & 0x1F, data, now);
+	apuschedule(m);
+}
+
+static const struct devonbus apubus = { 0x4000, 0x4017, regwrite, regread, NULL };
+
+
+void apuinit(struct nemu_machine *m)
+{
+	struct apu *a = &m->apu;
+	uint64_t now = m->cpu.clock_count;
+
+	memset(a, 0, sizeof(*a));
+	a->on = 1;
+	a->noise.lfsr = 1;
+	a->pulse[0].next = a->pulse[1].next = a->triangle.next = a->noise.next = now;
+	a->dmc.clock = a->dmc.next = now;
+	a->seqstart = a->clock = now;
+	a->irqat = now + seqsteps[0][3];
+	a->synthat = now + APUFRAME;
+	m->apulogn = 0;
+	cpuirqline(m, IRQFRAME | IRQDMC, 0);
+
+	// the controllers share the page, the apu passes them on
+	busmapio(m, &apubus);
+	apuschedule(m);
+}
+
+
+struct audio *audionew(uint32_t rate, FILE *wav)
+{
+	struct audio *a = calloc(1, sizeof(*a));
+	double slots = APUHZ / AUDIODIV;
+	double cutoff = (rate * 0.45 < 20000 ? rate * 0.45 : 20000) / slots;
+
+	if (!a)
+		return NULL;
+
+	a->rate = rate;
+	a->step = (uint64_t)(slots / rate * ONE);
+	a->dc = expf(-2 * (float)M_PI * 40 / rate);
+	a->clock = UINT64_MAX;
+
+	// windowed sinc, one row per fraction of a slot the sample falls on
+	for (int ph = 0; ph < AUDIOPHASES; ph++) {
+		double sum = 0;
+
+		for (int t = 0; t < AUDIOTAPS; t++) {
+			double d = t - AUDIOTAPS / 2 + 1 - (double)ph / AUDIOPHASES;
+			double x = (d + AUDIOTAPS / 2) / AUDIOTAPS;
+			double w = 0.42 - 0.5 * cos(2 * M_PI * x) + 0.08 * cos(4 * M_PI * x);
+			double h = d == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * d) / (M_PI * d);
+
+			a->kernel[ph][t] = h * w;
+			sum += h * w;
+		}
+		for (int t = 0; t < AUDIOTAPS; t++)
+			a->kernel[ph][t] /= sum;
+	}
+
+	if (wav) {
+		uint8_t hdr[WAVHDR] = { 0 };
+
+		a->wav = wav;
+		if (fwrite(hdr, 1, sizeof(hdr), wav) != sizeof(hdr)) {
+			free(a);
+			return NULL;
+		}
+	}
+
+	return a;
+}
+
+
+int audioclose(struct audio *a)
+{
+	int err;
+
+	if (!a)
+		return 0;
+
+	drain(a);
+	err = a->err;
+
+	if (a->wav && !err) {
+		uint8_t hdr[WAVHDR];
+		uint32_t bytes = a->written * 2;
+
+		memcpy(hdr, "RIFF", 4);
+		put32(hdr + 4, 36 + bytes);
+		memcpy(hdr + 8, "WAVEfmt ", 8);
+		put32(hdr + 16, 16);
+		put16(hdr + 20, 1);    // pcm
+		put16(hdr + 22, 1);    // mono
+		put32(hdr + 24, a->rate);
+		put32(hdr + 28, a->rate * 2);
+		put16(hdr + 32, 2);
+		put16(hdr + 34, 16);
+		memcpy(hdr + 36, "data", 4);
+		put32(hdr + 40, bytes);
+		if (fseek(a->wav, 0, SEEK_SET) != 0 || fwrite(hdr, 1, sizeof(hdr), a->wav) != sizeof(hdr))
+			err = errno ? errno : EIO;
+	}
+
+	free(a);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+
+void nemu_set_audio(struct nemu_machine *m, struct audio *a)
+{
+	// what came before isn't heard
+	apusync(m);
+	m->audio = a;
+}
+
+
+size_t audioread(struct nemu_machine *m, int16_t *out, size_t n)
+{
+	struct audio *a = m->audio;
+	size_t i;
+
+	if (!a)
+		return 0;
+
+	apusync(m);
+	for (i = 0; i < n && a->count; i++) {
+		out[i] = a->ring[a->head];
+		a->head = (a->head + 1) % AUDIORING;
+		a->count--;
+	}
+
+	return i;
+}
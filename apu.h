@@ -0,0 +1,155 @@
+#ifndef APU_H_
+#define APU_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+// the sound chip, ntsc timing. nothing is ticked along with the cpu:
+// register writes are only logged against clock_count, and apusync()
+// replays the log in one batch, running the channels from one change to
+// the next and putting each step of the output into a delta buffer that
+// is then resampled. it runs once a frame, when the log fills and when
+// $4015 asks for the length counters. the frame counter's irq and the
+// dmc's memory reads are what the cpu sees on time, they are scheduled
+// events. the dmc's bytes go into the log for the batch to play.
+
+#define APUFRAME   29830    // cpu cycles in the 4 step frame sequence
+#define APULOG     1024     // writes logged before a batch is forced
+#define APUDMCBYTE 0x18     // log entries past the registers: a dmc byte starts playing
+
+struct apuwrite {
+	uint64_t clock;
+	uint8_t reg;         // $40xx or APUDMCBYTE
+	uint8_t data;
+};
+
+struct apuenvelope {
+	uint8_t start;
+	uint8_t divider;
+	uint8_t decay;
+};
+
+struct apupulse {
+	uint8_t ctrl;        // duty, halt, constant volume, volume
+	uint8_t sweep;
+	uint16_t period;
+	uint8_t length;
+	uint8_t step;        // duty sequencer
+	struct apuenvelope env;
+	uint8_t sweepdivider;
+	uint8_t sweepreload;
+	uint8_t out;         // what it puts out now
+	uint64_t next;       // clock its timer steps the sequencer on
+};
+
+struct aputriangle {
+	uint8_t ctrl;        // halt and the linear counter's reload
+	uint16_t period;
+	uint8_t length;
+	uint8_t linear;
+	uint8_t reload;
+	uint8_t step;
+	uint8_t out;
+	uint64_t next;
+};
+
+struct apunoise {
+	uint8_t ctrl;
+	uint8_t mode;        // $400E
+	uint16_t lfsr;
+	uint8_t length;
+	struct apuenvelope env;
+	uint8_t out;
+	uint64_t next;
+};
+
+struct apudmc {
+	uint8_t ctrl;        // irq, loop and rate
+	uint8_t start;       // $4012
+	uint8_t len;         // $4013
+
+	// the memory reader, run on time
+	uint16_t addr;
+	uint16_t left;       // bytes still to fetch
+	uint8_t buf;
+	uint8_t full;
+	uint64_t clock;      // start of the output unit's current 8 bits
+
+	// the output unit, run by the batch
+	uint8_t rate;        // as of the batch's $4010
+	uint8_t level;
+	uint8_t shift;
+	uint8_t bits;        // left in shift
+	uint64_t next;       // clock the next bit comes out on
+};
+
+struct apu {
+	uint8_t on;          // apuinit() put it on the bus
+	struct apupulse pulse[2];
+	struct aputriangle triangle;
+	struct apunoise noise;
+	struct apudmc dmc;
+	uint8_t enable;      // $4015 as written
+
+	// the frame sequencer as the batch runs it
+	uint8_t mode;        // 5 step
+	uint8_t seqstep;
+	uint64_t seqstart;   // clock the sequence last began on
+
+	// what the cpu sees on time
+	uint8_t inhibit;     // no frame irq
+	uint8_t frameirq;
+	uint8_t dmcirq;
+	uint64_t irqat;      // next frame irq, UINT64_MAX for none
+	uint64_t synthat;    // next batch, one a frame
+
+	uint64_t clock;      // the batch has run up to here
+};
+
+// where the samples go: resampled to rate, 16 bit mono, kept for
+// audioread() or written out to a wav file as they come
+#define AUDIODIV    16      // cpu cycles to a slot of the delta buffer
+#define AUDIOSLOTS  4096
+#define AUDIOTAPS   32      // of the resampling filter
+#define AUDIOPHASES 64
+#define AUDIORING   16384   // samples kept for audioread(), older ones are dropped
+
+struct audio {
+	uint32_t rate;
+	uint64_t base;       // clock of the first slot after the filter's history
+	uint64_t clock;      // deltas are in up to here
+	uint64_t pos;        // next sample, in slots, 32.32 fixed point
+	uint64_t step;       // slots per sample
+	float level;         // the output after the integrated slots
+	float buf[AUDIOTAPS + AUDIOSLOTS + 2];    // integrated history, then deltas
+	float kernel[AUDIOPHASES][AUDIOTAPS];
+	float dcin;          // the dc blocker's last input and output
+	float dcout;
+	float dc;
+
+	int16_t ring[AUDIORING];
+	size_t head;         // oldest sample kept
+	size_t count;
+
+	FILE *wav;
+	uint32_t written;    // samples in the wav so far
+	int err;             // first write error
+};
+
+struct nemu_machine;
+
+void apuinit(struct nemu_machine *m);     // power on and put $4000-$4017 on the bus
+void apusync(struct nemu_machine *m);     // run the batch up to clock_count
+void apuevent(struct nemu_machine *m);    // the scheduler's call
+void apuschedule(struct nemu_machine *m); // work out when the next event is due, after a state load say
+_Bool apucanirq(struct nemu_machine *m);  // the frame counter or the dmc may still raise irq by itself
+
+// where apusync() puts the samples, or NULL for nowhere. the caller keeps
+// the sink and closes it after taking it back off.
+void nemu_set_audio(struct nemu_machine *m, struct audio *a);
+
+struct audio *audionew(uint32_t rate, FILE *wav);    // wav may be NULL, NULL without memory
+int audioclose(struct audio *a);          // finish the wav and free, 0 or -1 with errno set
+size_t audioread(struct nemu_machine *m, int16_t *out, size_t n);    // sync and take up to n samples
+
+#endif // APU_H_
@@ -0,0 +1,384 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "machine.h"
+#include "rewind.h"
+#include "state.h"
+
+#define SLICE 10000    // cycles between self-loop checks
+#define FRAME 29781    // ntsc cpu cycles per frame, the monkey's press rate
+
+const char *batchstopname[] = {
+	[BATCH_TRAP]   = "trap",
+	[BATCH_BREAK]  = "break",
+	[BATCH_WRITE]  = "write",
+	[BATCH_CYCLES] = "cycles",
+};
+
+const char batchhelp[] =
+	"  -a addr    load a raw image at addr (default 0)\n"
+	"  -e addr    set the reset vector to addr\n"
+	"  -p addr    stop when pc reaches addr\n"
+	"  -w addr    stop on a write to addr, the byte written is the exit status.\n"
+	"             a cart's addr has to be below $8000, where the mapper can't\n"
+	"             switch it away\n"
+	"  -c n       stop after n cycles\n"
+	"  -n         don't stop on a jump or branch to itself\n"
+	"  -s file    start from a snapshot taken with the same image\n"
+	"  -m seed    press random buttons on pad 1 every frame\n"
+	"\n"
+	"exit status: 0 on reaching -p or on a trap without -p, 1 on a trap\n"
+	"elsewhere, 2 on the cycle limit, 3 if the image can't be loaded\n";
+
+// sits on the page of the magic address. reads stay on the fast path,
+// writes are passed on to whatever was mapped there before.
+struct magicdev {
+	struct devonbus dev;    // first, the page's dev pointer doubles as ours
+	struct buspage under;
+	uint8_t value;
+};
+
+
+void batchdefaults(struct batchopts *o)
+{
+	o->loadaddr = 0x0000;
+	o->entry = -1;
+	o->trappc = -1;
+	o->magic = -1;
+	o->maxcycles = 0;
+	o->selfloop = 1;
+	o->state = NULL;
+	o->rewind = NULL;
+	o->rewindevery = 0;
+	o->monkey = 0;
+}
+
+
+static int address(const char *s, int32_t *n)
+{
+	char *end;
+	long v = strtol(s, &end, 0);
+
+	if (*s == '\0' || *end != '\0' || v < 0 || v > 0xFFFF)
+		return -1;
+
+	*n = v;
+	return 0;
+}
+
+
+int batchopt(struct batchopts *o, int opt, const char *arg)
+{
+	int32_t n;
+	char *end;
+
+	switch (opt) {
+	case 'a':
+		if (address(arg, &n) < 0)
+			return -1;
+		o->loadaddr = n;
+		return 0;
+	case 'e': return address(arg, &o->entry);
+	case 'p': return address(arg, &o->trappc);
+	case 'w': return address(arg, &o->magic);
+	case 'c':
+		o->maxcycles = strtoull(arg, &end, 0);
+		return *arg == '\0' || *end != '\0' ? -1 : 0;
+	case 'n':
+		o->selfloop = 0;
+		return 0;
+	case 's':
+		o->state = arg;
+		return 0;
+	case 'm':
+		o->monkey = strtoul(arg, &end, 0);
+		return *arg == '\0' || *end != '\0' ? -1 : 0;
+	}
+
+	return -1;
+}
+
+
+static int loadraw(struct nemu_machine *m, FILE *f, uint16_t addr)
+{
+	size_t n = fread(m->ram + addr, 1, RAMSIZE - addr, f);
+
+	if (ferror(f))
+		return -1;
+	if (fgetc(f) != EOF) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	return n;
+}
+
+
+static int loadstate(struct nemu_machine *m, const char *path)
+{
+	FILE *f;
+	long n;
+	uint8_t *buf;
+	int ret = -1;
+
+	if (!path)
+		return 0;
+
+	if (!(f = fopen(path, "rb")))
+		return -1;
+
+	if (fseek(f, 0, SEEK_END) == 0 && (n = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0) {
+		if ((buf = malloc(n ? n : 1))) {
+			if (fread(buf, 1, n, f) == (size_t)n)
+				ret = nemu_load_state(m, buf, n);
+			free(buf);
+		}
+	}
+
+	fclose(f);
+	return ret;
+}
+
+
+// load an image into a freshly initialised machine and reset the cpu into
+// it, or into the snapshot in o->state. iNES files go in as a cart, anything else is a raw image. without an
+// entry point a raw image starts at its load address unless it brings its
+// own reset vector. the vector in a cart's rom can't be patched, there the
+// entry point only moves pc.
+int batchload(struct nemu_machine *m, const char *path, const struct batchopts *o)
+{
+	FILE *f = fopen(path, "rb");
+	uint8_t hdr[4];
+	int32_t entry = o->entry;
+	int ret;
+
+	if (!f)
+		return -1;
+
+	if (fread(hdr, 1, sizeof(hdr), f) == sizeof(hdr) && memcmp(hdr, "NES\x1A", 4) == 0) {
+		fclose(f);
+		// banks() maps over the magic device whenever the mapper switches
+		if (o->magic >= 0x8000) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (cartopen(&m->cart, path) < 0)
+			return -1;
+		if (cartmap(m, &m->cart) < 0)
+			return -1;
+		ramnes(m);
+		ppuinit(m);
+		inputinit(m);
+		apuinit(m);
+		cpureset(m);
+		if (entry >= 0)
+			m->cpu.pc = entry;
+		return loadstate(m, o->state);
+	}
+
+	rewind(f);
+	ret = loadraw(m, f, o->loadaddr);
+	fclose(f);
+	if (ret < 0)
+		return -1;
+
+	if (entry < 0 && o->loadaddr + ret < 0xFFFE)
+		entry = o->loadaddr;
+	if (entry >= 0) {
+		m->ram[0xFFFC] = entry & 0xFF;
+		m->ram[0xFFFD] = entry >> 8;
+	}
+	cpureset(m);
+
+	return loadstate(m, o->state);
+}
+
+
+int batchsave(struct nemu_machine *m, const char *path)
+{
+	size_t n = nemu_save_state(m, NULL, 0);
+	uint8_t *buf = malloc(n);
+	FILE *f;
+
+	if (!buf)
+		return -1;
+
+	nemu_save_state(m, buf, n);
+
+	if (!(f = fopen(path, "wb"))) {
+		free(buf);
+		return -1;
+	}
+
+	size_t w = fwrite(buf, 1, n, f);
+	free(buf);
+	if (fclose(f) != 0 || w != n)
+		return -1;
+
+	return 0;
+}
+
+
+static void magicwrite(struct nemu_machine *m, uint16_t addr, uint8_t data)
+{
+	struct magicdev *d = (struct magicdev *)m->bus.page[addr >> 8].dev;
+
+	if (addr == d->dev.startaddr) {
+		d->value = data;
+		cpuhalt(m);
+	}
+
+	if (d->under.mem) {
+		d->under.mem[addr & 0xFF] = data;
+		bustouch(m, addr >> 8);
+	} else if (d->under.dev && d->under.dev->write) {
+		d->under.dev->write(m, d->under.base | (addr & d->under.mask), data);
+	}
+}
+
+
+static uint8_t magicread(struct nemu_machine *m, uint16_t addr)
+{
+	struct magicdev *d = (struct magicdev *)m->bus.page[addr >> 8].dev;
+
+	if (d->under.dev && d->under.dev->read)
+		return d->under.dev->read(m, d->under.base | (addr & d->under.mask));
+
+	return 0x00;
+}
+
+
+// a jump to itself only ends on an interrupt: nmi from the ppu's vblank
+// or a replayed log, irq from the log, the apu or the cart. the apu's
+// batches and the ppu's catching up are scheduled too, but raise neither.
+static _Bool interruptible(struct nemu_machine *m)
+{
+	if (m->ppu.on && (m->ppu.ctrl & CTRLNMI))
+		return 1;
+	if (inputdue(m) != UINT64_MAX)
+		return 1;
+	if (m->cpu.status & I)
+		return 0;
+
+	return m->cpu.irq || apucanirq(m) || cartcanirq(m);
+}
+
+
+// xorshift, the same seed presses the same buttons everywhere
+static uint32_t monkeypress(uint32_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 17;
+	*x ^= *x << 5;
+	return *x;
+}
+
+
+// run until one of the exit conditions in o is met. a log m is replaying
+// feeds itself in through the scheduler, one being recorded sees the
+// monkey's presses.
+void batchrun(struct nemu_machine *m, const struct batchopts *o, struct batchresult *r)
+{
+	struct magicdev magic = { .dev = { 0, 0, magicwrite, magicread, NULL } };
+	uint64_t cycles = m->cpu.clock_count;
+	uint64_t instructions = m->cpu.instructions;
+	uint64_t capture = m->cpu.clock_count;
+	uint64_t press = m->cpu.clock_count;
+	uint32_t seed = o->monkey;
+	_Bool replay = m->log && m->log->mode == INPUTREPLAY;
+
+	if (o->magic >= 0) {
+		uint8_t *mem = m->bus.page[o->magic >> 8].mem;
+
+		// magicwrite() goes around the bus, into ram of our own
+		if (mem)
+			ramown(m, (mem - m->ram) / BUSPAGESIZE);
+		magic.dev.startaddr = magic.dev.endaddr = o->magic;
+		magic.under = m->bus.page[o->magic >> 8];
+		busmapio(m, &magic.dev);
+		m->bus.page[o->magic >> 8].rd = magic.under.rd;
+	}
+	if (o->trappc >= 0)
+		cpubreak(m, o->trappc, 1);
+
+	for (;;) {
+		uint64_t used = m->cpu.clock_count - cycles;
+		uint32_t budget = SLICE;
+
+		if (o->maxcycles && used >= o->maxcycles) {
+			r->stop = BATCH_CYCLES;
+			break;
+		}
+		if (o->maxcycles && o->maxcycles - used < budget)
+			budget = o->maxcycles - used;
+
+		if (o->rewind) {
+			if (m->cpu.clock_count >= capture) {
+				rewindcapture(o->rewind, m);
+				capture = m->cpu.clock_count + o->rewindevery;
+			}
+			if (capture - m->cpu.clock_count < budget)
+				budget = capture - m->cpu.clock_count;
+		}
+
+		if (seed && !replay) {
+			if (m->cpu.clock_count >= press) {
+				inputpad(m, 0, monkeypress(&seed));
+				press = m->cpu.clock_count + FRAME;
+			}
+			if (press - m->cpu.clock_count < budget)
+				budget = press - m->cpu.clock_count;
+		}
+
+		cpurun(m, budget);
+		if (m->cpu.stop == CPU_HALT || m->cpu.stop == CPU_BREAK)
+			goto stopped;
+
+		// not once the cycles are up, the probe would run past them
+		if (o->selfloop && !(o->maxcycles && m->cpu.clock_count - cycles >= o->maxcycles) &&
+		    !interruptible(m)) {
+			uint16_t pc = m->cpu.pc;
+			uint64_t n = m->cpu.instructions;
+
+			cpurun(m, 1);
+			if (m->cpu.stop == CPU_HALT || m->cpu.stop == CPU_BREAK)
+				goto stopped;
+			// a dma stall left over from the slice runs no instruction
+			if (m->cpu.instructions != n && m->cpu.pc == pc) {
+				r->stop = BATCH_TRAP;
+				break;
+			}
+		}
+		continue;
+
+stopped:
+		r->stop = m->cpu.stop == CPU_HALT ? BATCH_WRITE : BATCH_BREAK;
+		break;
+	}
+
+	if (o->trappc >= 0)
+		cpubreak(m, o->trappc, 0);
+	if (o->magic >= 0) {
+		m->bus.page[o->magic >> 8] = magic.under;
+		bustouch(m, o->magic >> 8);
+	}
+
+	r->value = magic.value;
+	r->cycles = m->cpu.clock_count - cycles;
+	r->instructions = m->cpu.instructions - instructions;
+}
+
+
+int batchstatus(const struct batchopts *o, const struct batchresult *r)
+{
+	switch (r->stop) {
+	case BATCH_WRITE:  return r->value;
+	case BATCH_BREAK:  return 0;
+	case BATCH_TRAP:   return o->trappc >= 0;
+	}
+
+	return 2;
+}
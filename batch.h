@@ -0,0 +1,53 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include <stdint.h>
+
+// headless runs of test images: load a raw binary or an iNES file, run it
+// at full speed and stop on a trap, a breakpoint, a write to a magic
+// address or a cycle limit.
+
+struct nemu_machine;
+struct rewind;
+
+enum BATCHSTOP {
+	BATCH_TRAP,      // an instruction jumped or branched to itself, noticed
+	                 // within a few thousand cycles
+	BATCH_BREAK,     // reached the trap pc
+	BATCH_WRITE,     // wrote to the magic address
+	BATCH_CYCLES,    // ran into the cycle limit
+};
+
+struct batchopts {
+	uint16_t loadaddr;     // where a raw image goes
+	int32_t entry;         // reset vector to install, -1 keeps the image's
+	int32_t trappc;        // stop when pc gets here, -1 for none
+	int32_t magic;         // stop on a write here, -1 for none
+	uint64_t maxcycles;    // 0 for no limit
+	_Bool selfloop;        // stop on a jump or branch to itself
+	const char *state;     // snapshot to start from instead of reset, or NULL
+	struct rewind *rewind;     // history to capture into, or NULL
+	uint64_t rewindevery;      // cycles between captures
+	uint32_t monkey;       // seed for random presses on pad 1 every frame, 0 for none
+};
+
+struct batchresult {
+	uint8_t stop;          // BATCHSTOP
+	uint8_t value;         // byte written to the magic address
+	uint64_t cycles;
+	uint64_t instructions;
+};
+
+#define BATCHOPTS "a:e:p:w:c:ns:m:"    // getopt() letters handled by batchopt()
+
+extern const char *batchstopname[];
+extern const char batchhelp[];      // usage lines for BATCHOPTS
+
+void batchdefaults(struct batchopts *o);
+int batchopt(struct batchopts *o, int opt, const char *arg);    // 0 or -1 on a bad argument
+int batchload(struct nemu_machine *m, const char *path, const struct batchopts *o);    // 0 or -1 with errno set
+int batchsave(struct nemu_machine *m, const char *path);     // snapshot to a file, 0 or -1 with errno set
+void batchrun(struct nemu_machine *m, const struct batchopts *o, struct batchresult *r);
+int batchstatus(const struct batchopts *o, const struct batchresult *r);    // exit status, 0 passes
+
+#endif // BATCH_H_
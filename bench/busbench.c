@@ -0,0 +1,208 @@
+// bus microbenchmark: accesses per second through the page table against
+// the linear devlist scan it replaced, on an nes-like memory map. then
+// writes with dirty tracking armed every round against none, which fails
+// the run if tracking costs more than TRACKSLACK.
+//
+//   make bench/busbench && bench/busbench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "machine.h"
+
+#define NADDR  (1 << 16)
+#define ROUNDS 512
+#define PAIRS  4096      // rounds of writes, tracked next to untracked
+#define TRACKSLACK 0.03
+
+static struct nemu_machine machine;
+static uint16_t addrs[NADDR];
+static uint8_t regs[0x20];
+
+
+static uint8_t ramread(struct nemu_machine *m, uint16_t addr)              { return m->ram[addr & 0x07FF]; }
+static void ramwrite(struct nemu_machine *m, uint16_t addr, uint8_t data)  { m->ram[addr & 0x07FF] = data; }
+static uint8_t ioread(struct nemu_machine *m, uint16_t addr)               { (void)m; return regs[addr & 0x1F]; }
+static void iowrite(struct nemu_machine *m, uint16_t addr, uint8_t data)   { (void)m; regs[addr & 0x1F] = data; }
+static uint8_t romread(struct nemu_machine *m, uint16_t addr)              { return m->ram[addr]; }
+static void romwrite(struct nemu_machine *m, uint16_t addr, uint8_t data)  { (void)m; (void)addr; (void)data; }
+
+// the old bus: walk the device list on every access
+static struct devonbus devlist[] = {
+	{ 0x0000, 0x1FFF, ramwrite, ramread, NULL },
+	{ 0x2000, 0x3FFF, iowrite, ioread, NULL },
+	{ 0x4000, 0x40FF, iowrite, ioread, NULL },
+	{ 0x4100, 0x7FFF, ramwrite, ramread, NULL },
+	{ 0x8000, 0xFFFF, romwrite, romread, NULL },
+};
+
+static struct devonbus ppu = { 0x2000, 0x2007, iowrite, ioread, NULL };
+static struct devonbus apu = { 0x4000, 0x40FF, iowrite, ioread, NULL };
+
+
+static uint8_t scanread(uint16_t addr)
+{
+	for (size_t i = 0; i < sizeof(devlist)/sizeof(devlist[0]); i++) {
+		if (devlist[i].startaddr <= addr && addr <= devlist[i].endaddr)
+			return devlist[i].read(&machine, addr);
+	}
+
+	return 0x00;
+}
+
+
+static void scanwrite(uint16_t addr, uint8_t data)
+{
+	for (size_t i = 0; i < sizeof(devlist)/sizeof(devlist[0]); i++) {
+		if (devlist[i].startaddr <= addr && addr <= devlist[i].endaddr) {
+			devlist[i].write(&machine, addr, data);
+			return;
+		}
+	}
+}
+
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+// roughly what a game does: mostly code fetches from prg rom and zero
+// page / stack traffic, with the odd register poke
+static void genaddrs()
+{
+	uint32_t seed = 0x6502;
+
+	for (int i = 0; i < NADDR; i++) {
+		seed = seed * 1103515245 + 12345;
+		uint32_t r = seed >> 8;
+
+		switch (r % 16) {
+		case 0:  addrs[i] = 0x2000 | (r >> 4 & 0x07); break;
+		case 1:  addrs[i] = 0x4000 | (r >> 4 & 0x17); break;
+		case 2:
+		case 3:
+		case 4:  addrs[i] = r >> 4 & 0x07FF; break;
+		case 5:  addrs[i] = 0x6000 | (r >> 4 & 0x1FFF); break;
+		default: addrs[i] = 0x8000 | (r >> 4 & 0x7FFF); break;
+		}
+	}
+}
+
+
+static void report(const char *name, double secs, uint32_t sum)
+{
+	double n = (double)NADDR * ROUNDS;
+	printf("%-12s %8.1f M accesses/s  (%.2f ns/access, sum %08x)\n",
+			name, n / secs / 1e6, secs / n * 1e9, sum);
+}
+
+
+static int cmpdouble(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+
+// one round of the writes with every page watched at the start, as the
+// rewind ring and generation holders would have them, or none
+static double writes(_Bool tracked)
+{
+	uint32_t gens[BUSPAGES];
+	double t = now();
+
+	if (tracked) {
+		busclean(&machine);
+		busgens(&machine, gens);
+	}
+	for (int i = 0; i < NADDR; i++)
+		buswrite(&machine, addrs[i], i);
+	t = now() - t;
+
+	// every write page went dirty
+	if (tracked && (!busdirty(&machine, 0x00) || busgen(&machine, 0x00) == gens[0]))
+		printf("tracked write missed a page\n");
+	return t;
+}
+
+
+int main(void)
+{
+	uint8_t *ram = machine.ram;
+
+	genaddrs();
+	nemu_init(&machine);
+	for (int i = 0; i < RAMSIZE; i++)
+		ram[i] = i * 7;
+
+	busmapmem(&machine, 0x0000, 0x07FF, ram, 1);
+	busmirror(&machine, 0x0000, 0x1FFF, 0x0800);
+	busmapio(&machine, &ppu);
+	busmirror(&machine, 0x2000, 0x3FFF, 0x0008);
+	busmapio(&machine, &apu);
+	busmapmem(&machine, 0x8000, 0xFFFF, ram + 0x8000, 0);
+
+	double t;
+	uint32_t sum;
+
+	sum = 0;
+	t = now();
+	for (int r = 0; r < ROUNDS; r++)
+		for (int i = 0; i < NADDR; i++)
+			sum += scanread(addrs[i]);
+	report("scan read", now() - t, sum);
+
+	sum = 0;
+	t = now();
+	for (int r = 0; r < ROUNDS; r++)
+		for (int i = 0; i < NADDR; i++)
+			sum += busread(&machine, addrs[i], 0);
+	report("page read", now() - t, sum);
+
+	t = now();
+	for (int r = 0; r < ROUNDS; r++)
+		for (int i = 0; i < NADDR; i++)
+			scanwrite(addrs[i], i);
+	report("scan write", now() - t, ram[0]);
+
+	// rounds in pairs, the median of each pair's ratio. the machine's mood
+	// drifts less within a pair than between the best of each, and whichever
+	// goes second runs slower, so they take turns.
+	static double ratio[PAIRS];
+	double plain = 0, tracked = 0;
+
+	for (int i = 0; i < PAIRS; i++) {
+		double a, b;
+
+		if (i & 1) {
+			b = writes(1);
+			a = writes(0);
+		} else {
+			a = writes(0);
+			b = writes(1);
+		}
+		plain += a;
+		tracked += b;
+		ratio[i] = b / a;
+	}
+	qsort(ratio, PAIRS, sizeof(ratio[0]), cmpdouble);
+	report("page write", plain * ROUNDS / PAIRS, ram[0]);
+	report("tracked", tracked * ROUNDS / PAIRS, ram[0]);
+
+	double cost = ratio[PAIRS / 2] - 1;
+
+	if (cost > TRACKSLACK) {
+		printf("dirty tracking costs %.1f%% on writes, over %.0f%%\n", cost * 100, TRACKSLACK * 100);
+		return 1;
+	}
+	printf("dirty tracking costs %.1f%% on writes\n", cost * 100);
+
+	return 0;
+}
@@ -0,0 +1,318 @@
+// cpu benchmark: runs fixed 6502 workloads headless through cpurun() and
+// reports emulated MHz, instructions per second and host ns per instruction.
+//
+//   make bench                          all workloads with the default core
+//   make bench CORE=1 LAZYFLAGS=1       pick the core and flag mode
+//   make bench TRACE=1                  also time a run with tracing on
+//   make bench KLAUS=6502_functional_test.bin
+//   bench/cpubench [klaus.bin [cycles]]
+//
+// the klaus dormann functional test is not shipped. pass a 64K image built
+// with the default load address ($0000) and entry point ($0400); the nes
+// cpu has no decimal mode, so build it with disable_decimal = 1 or it will
+// trap in the decimal tests.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "machine.h"
+#include "rewind.h"
+#include "state.h"
+
+#define SLICE  100000         // cycles per cpurun() call
+#define CYCLES 200000000ULL   // cycles per workload
+
+#define FRAME  29781          // ntsc cpu cycles per frame, the rewind capture rate
+#define REWINDBYTES (4 << 20)
+#define TRACERECORDS (1 << 20)
+
+#define KLAUSENTRY   0x0400
+#define KLAUSSUCCESS 0x3469
+
+struct workload {
+	const char *name;
+	const uint8_t *code;
+	size_t size;
+	const uint8_t *sub;         // optional subroutine at $8030
+	size_t subsize;
+};
+
+// tight alu loop, mostly register and zero page ops
+static const uint8_t alu[] = {
+	0xA2, 0x00,          //       ldx #0
+	0xA0, 0x00,          //       ldy #0
+	0x18,                //       clc
+	0x69, 0x37,          // loop: adc #$37
+	0x45, 0x10,          //       eor $10
+	0x0A,                //       asl a
+	0x2A,                //       rol a
+	0x85, 0x10,          //       sta $10
+	0xE8,                //       inx
+	0x88,                //       dey
+	0xD0, 0xF4,          //       bne loop
+	0x4C, 0x00, 0x80,    //       jmp $8000
+};
+
+// copy $2000-$2FFF to $3000-$3FFF through indirect indexed pointers
+static const uint8_t memcpy6502[] = {
+	0xA9, 0x00,          //       lda #0
+	0x85, 0x00,          //       sta $00
+	0x85, 0x02,          //       sta $02
+	0xA9, 0x20,          //       lda #$20
+	0x85, 0x01,          //       sta $01
+	0xA9, 0x30,          //       lda #$30
+	0x85, 0x03,          //       sta $03
+	0xA2, 0x10,          //       ldx #16
+	0xA0, 0x00,          //       ldy #0
+	0xB1, 0x00,          // copy: lda ($00),y
+	0x91, 0x02,          //       sta ($02),y
+	0xC8,                //       iny
+	0xD0, 0xF9,          //       bne copy
+	0xE6, 0x01,          //       inc $01
+	0xE6, 0x03,          //       inc $03
+	0xCA,                //       dex
+	0xD0, 0xF2,          //       bne copy
+	0x4C, 0x00, 0x80,    //       jmp $8000
+};
+
+// data dependent branches and subroutine calls
+static const uint8_t branchy[] = {
+	0xA2, 0x00,          //       ldx #0
+	0x8A,                // loop: txa
+	0x29, 0x03,          //       and #3
+	0xF0, 0x0B,          //       beq zero
+	0xC9, 0x02,          //       cmp #2
+	0x90, 0x0A,          //       bcc one
+	0xF0, 0x0B,          //       beq two
+	0x20, 0x30, 0x80,    //       jsr sub
+	0xD0, 0x09,          //       bne next
+	0xC8,                // zero: iny
+	0xD0, 0x06,          //       bne next
+	0x88,                // one:  dey
+	0x10, 0x03,          //       bpl next
+	0x20, 0x30, 0x80,    // two:  jsr sub
+	0xE8,                // next: inx
+	0xD0, 0xE4,          //       bne loop
+	0x4C, 0x00, 0x80,    //       jmp $8000
+};
+
+static const uint8_t branchysub[] = {
+	0xE6, 0x20,          // sub:  inc $20
+	0xA5, 0x20,          //       lda $20
+	0x30, 0x01,          //       bmi neg
+	0x60,                //       rts
+	0x09, 0x01,          // neg:  ora #1
+	0x60,                //       rts
+};
+
+static const struct workload workloads[] = {
+	{ "alu",     alu,        sizeof(alu),        NULL,       0 },
+	{ "memcpy",  memcpy6502, sizeof(memcpy6502), NULL,       0 },
+	{ "branchy", branchy,    sizeof(branchy),    branchysub, sizeof(branchysub) },
+};
+
+
+static const char *corename(void)
+{
+	switch (NEMU_CORE) {
+	case CORE_TABLE:    return "table";
+	case CORE_SWITCH:   return "switch";
+	case CORE_THREADED: return "threaded";
+	case CORE_BLOCK:    return "block";
+	}
+
+	return "?";
+}
+
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+// fnv-1a over the registers and memory, so a core that gets faster by
+// getting things wrong shows up as a different checksum
+static uint32_t checksum(struct nemu_machine *m)
+{
+	uint8_t regs[] = { m->cpu.a, m->cpu.x, m->cpu.y, m->cpu.stkp, m->cpu.pc & 0xFF, m->cpu.pc >> 8 };
+	uint32_t h = 2166136261u;
+
+	for (size_t i = 0; i < sizeof(regs); i++)
+		h = (h ^ regs[i]) * 16777619u;
+	for (size_t i = 0; i < RAMSIZE; i++)
+		h = (h ^ m->ram[i]) * 16777619u;
+
+	return h;
+}
+
+
+static void report(const char *name, struct nemu_machine *m, uint64_t cycles, uint64_t instructions, double t)
+{
+	printf("%-8s %-8s %-5s %12llu cyc %12llu ins %9.2f MHz %9.2f MIPS %7.2f ns/ins  %08x\n",
+	       name, corename(),
+#ifdef NEMU_LAZYFLAGS
+	       "lazy",
+#else
+	       "eager",
+#endif
+	       (unsigned long long)cycles, (unsigned long long)instructions,
+	       cycles / t * 1e-6, instructions / t * 1e-6,
+	       instructions ? t * 1e9 / instructions : 0.0,
+	       checksum(m));
+}
+
+
+// with r, capture into it every frame. with tr, trace into it.
+static void runworkload(struct nemu_machine *m, const struct workload *w, uint64_t budget, struct rewind *r,
+                        struct trace *tr)
+{
+	nemu_init(m);
+	m->trace = tr;
+	memcpy(&m->ram[0x8000], w->code, w->size);
+	if (w->sub)
+		memcpy(&m->ram[0x8030], w->sub, w->subsize);
+	for (int i = 0x2000; i < 0x3000; i++)
+		m->ram[i] = i * 7;
+	m->ram[0xFFFC] = 0x00;
+	m->ram[0xFFFD] = 0x80;
+	cpureset(m);
+
+	uint64_t cycles = m->cpu.clock_count;
+	uint64_t instructions = m->cpu.instructions;
+	double t = now();
+
+	if (r) {
+		rewindclear(r);
+		while (m->cpu.clock_count - cycles < budget) {
+			rewindcapture(r, m);
+			cpurun(m, FRAME);
+		}
+	} else {
+		while (m->cpu.clock_count - cycles < budget)
+			cpurun(m, SLICE);
+	}
+
+	t = now() - t;
+	report(m->trace ? "traced" : w->name, m, m->cpu.clock_count - cycles, m->cpu.instructions - instructions, t);
+	if (r)
+		printf("%-8s %zu captures, %zu bytes of deltas, %.1f bytes/capture\n", "rewind",
+		       rewindcount(r), rewindsize(r), (double)rewindsize(r) / rewindcount(r));
+}
+
+
+// snapshot cost on whatever the last workload left behind
+static void runstate(struct nemu_machine *m)
+{
+	static uint8_t buf[2 * RAMSIZE];
+	const int rounds = 20000;
+	size_t n = 0;
+	double t = now();
+
+	for (int i = 0; i < rounds; i++)
+		n = nemu_save_state(m, buf, sizeof(buf));
+	double save = (now() - t) / rounds;
+
+	t = now();
+	for (int i = 0; i < rounds; i++)
+		nemu_load_state(m, buf, n);
+	double load = (now() - t) / rounds;
+
+	printf("%-8s %zu bytes, save %.2f us, load %.2f us\n", "state", n, save * 1e6, load * 1e6);
+}
+
+
+// run the functional test until it jumps or branches to itself. returns 0
+// if it got stuck on the success trap.
+static int runklaus(struct nemu_machine *m, const char *path)
+{
+	FILE *f = fopen(path, "rb");
+
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+
+	nemu_init(m);
+	size_t n = fread(m->ram, 1, RAMSIZE, f);
+	fclose(f);
+	if (n != RAMSIZE) {
+		fprintf(stderr, "%s: expected a %d byte image\n", path, RAMSIZE);
+		return 1;
+	}
+
+	cpureset(m);
+	m->cpu.pc = KLAUSENTRY;
+
+	uint64_t cycles = m->cpu.clock_count;
+	uint64_t instructions = m->cpu.instructions;
+	double t = now();
+
+	for (;;) {
+		cpurun(m, SLICE);
+
+		// a trap is an instruction that leaves pc where it was
+		uint16_t pc = m->cpu.pc;
+		cpurun(m, 1);
+		if (m->cpu.pc == pc)
+			break;
+	}
+
+	t = now() - t;
+	report("klaus", m, m->cpu.clock_count - cycles, m->cpu.instructions - instructions, t);
+
+	if (m->cpu.pc != KLAUSSUCCESS) {
+		fprintf(stderr, "klaus: trapped at $%04X\n", m->cpu.pc);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct nemu_machine *m = nemu_new();
+	uint64_t budget = CYCLES;
+	int ret = 0;
+
+	if (!m)
+		return 1;
+
+	if (argc > 2)
+		budget = strtoull(argv[2], NULL, 0);
+
+	for (size_t i = 0; i < sizeof(workloads)/sizeof(workloads[0]); i++)
+		runworkload(m, &workloads[i], budget, NULL, NULL);
+	runstate(m);
+
+	// the memory copy dirties the most pages per frame
+	struct rewind *r = rewindnew(REWINDBYTES);
+
+	if (r) {
+		runworkload(m, &workloads[1], budget, r, NULL);
+		rewindfree(r);
+	}
+
+#ifdef NEMU_TRACE
+	struct trace *tr = tracenew(TRACERECORDS);
+
+	if (tr) {
+		runworkload(m, &workloads[2], budget, NULL, tr);
+		m->trace = NULL;
+		tracefree(tr);
+	}
+#endif
+
+	if (argc > 1 && argv[1][0])
+		ret = runklaus(m, argv[1]);
+
+	nemu_free(m);
+	return ret;
+}
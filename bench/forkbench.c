@@ -0,0 +1,119 @@
+// fork benchmark: what nemu_fork() costs against copying the whole
+// machine, with the parent idle and with it running a frame between
+// forks, and a child's frame against the parent's. a child that doesn't
+// end up where the parent does fails the run.
+//
+//   make bench/forkbench && bench/forkbench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "machine.h"
+#include "state.h"
+
+#define FORKS 20000
+#define FRAMES 600
+#define FRAME 29781    // ntsc cpu cycles per frame
+#define STATEMAX (1 << 20)
+
+// walks x through the zero page, a page of ram and the stack
+static const uint8_t code[] = {
+	0xA2, 0x00,          //       ldx #0
+	0xF6, 0x00,          // loop: inc $00,x
+	0xFE, 0x00, 0x03,    //       inc $0300,x
+	0x20, 0x0E, 0x80,    //       jsr sub
+	0xE8,                //       inx
+	0x4C, 0x02, 0x80,    //       jmp loop
+	0x8A,                // sub:  txa
+	0x48,                //       pha
+	0x68,                //       pla
+	0x60,                //       rts
+};
+
+static uint8_t statea[STATEMAX], stateb[STATEMAX];
+
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static void report(const char *name, double secs, int n)
+{
+	printf("%-20s %10.0f ns\n", name, secs / n * 1e9);
+}
+
+
+int main(void)
+{
+	struct nemu_machine *m, *copy;
+	double t, run;
+
+	if (!(m = nemu_new()) || !(copy = malloc(sizeof(*copy))))
+		return 3;
+	memcpy(&m->ram[0x8000], code, sizeof(code));
+	m->ram[0xFFFC] = 0x00;
+	m->ram[0xFFFD] = 0x80;
+	cpureset(m);
+	cpurun(m, FRAME);
+
+	t = now();
+	for (int i = 0; i < FORKS; i++)
+		memcpy(copy, m, sizeof(*m));
+	report("machine copy", now() - t, FORKS);
+
+	t = now();
+	for (int i = 0; i < FORKS; i++)
+		nemu_free(nemu_fork(m));
+	report("fork", now() - t, FORKS);
+
+	// the parent writes between forks, so each fork freezes those pages
+	t = run = 0;
+	for (int i = 0; i < FRAMES; i++) {
+		double u = now();
+
+		cpurun(m, FRAME);
+		run += now() - u;
+		u = now();
+		nemu_free(nemu_fork(m));
+		t += now() - u;
+	}
+	report("fork after a frame", t, FRAMES);
+	report("parent frame", run, FRAMES);
+
+	// children write their way off the shared pages
+	t = 0;
+	for (int i = 0; i < FRAMES; i++) {
+		struct nemu_machine *f = nemu_fork(m);
+		double u = now();
+
+		if (!f)
+			return 3;
+		cpurun(f, FRAME);
+		t += now() - u;
+		if (i == FRAMES - 1) {
+			size_t na, nb;
+
+			cpurun(m, FRAME);
+			na = nemu_save_state(m, statea, sizeof(statea));
+			nb = nemu_save_state(f, stateb, sizeof(stateb));
+			if (na != nb || memcmp(statea, stateb, na) != 0) {
+				printf("child ended up somewhere else\n");
+				return 1;
+			}
+		}
+		nemu_free(f);
+	}
+	report("child frame", t, FRAMES);
+
+	nemu_free(m);
+	free(copy);
+
+	return 0;
+}
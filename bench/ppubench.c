@@ -0,0 +1,182 @@
+// ppu benchmark: checks the vector pattern decoder against the plain c one
+// on every pair of bit planes, then times both and whole frames of a busy
+// random scene, drawn and headless.
+//
+//   make bench                          with SSE2, the x86-64 default
+//   make bench CFLAGS="-O2 -mavx2"      with AVX2
+//   make bench SCALAR=1                 with neither
+//   bench/ppubench [frames]
+//
+// the frame checksum covers every pixel drawn and has to come out the
+// same whichever way the build decodes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "machine.h"
+
+#define FRAME  29781          // ntsc cpu cycles per frame
+#define FRAMES 2000
+#define ROWS   0x10000        // one for every lo, hi pair
+#define DECODEROUNDS 200
+
+static uint8_t lo[ROWS], hi[ROWS], attr[ROWS];
+static uint8_t px[ROWS * 8], ref[ROWS * 8];
+static uint8_t chr[0x2000];
+static uint8_t screen[PPUHEIGHT][PPUWIDTH];
+static uint32_t seed = 0x2C02;
+
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static uint8_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+
+static const char *decodername(void)
+{
+#if !defined(NEMU_SCALAR) && defined(__AVX2__)
+	return "avx2";
+#elif !defined(NEMU_SCALAR) && defined(__SSE2__)
+	return "sse2";
+#else
+	return "scalar";
+#endif
+}
+
+
+// every row, then runs of every length up to a few vectors from odd
+// places for the tails
+static int check(void)
+{
+	for (int i = 0; i < ROWS; i++) {
+		lo[i] = i;
+		hi[i] = i >> 8;
+		attr[i] = rnd() & 0x7C;
+	}
+
+	ppudecode(lo, hi, attr, px, ROWS);
+	ppudecoderef(lo, hi, attr, ref, ROWS);
+	if (memcmp(px, ref, sizeof(px)) != 0) {
+		printf("%-8s decode differs from the reference\n", decodername());
+		return 1;
+	}
+
+	for (int n = 1; n <= 40; n++) {
+		for (int at = 0; at < 64; at += 7) {
+			memset(px, 0xAA, n * 8);
+			ppudecode(lo + at * 257, hi + at * 257, attr + at * 257, px, n);
+			if (memcmp(px, ref + at * 257 * 8, n * 8) != 0) {
+				printf("%-8s decode of %d rows differs from the reference\n", decodername(), n);
+				return 1;
+			}
+		}
+	}
+
+	printf("%-8s decode matches the reference on all %d rows\n", decodername(), ROWS);
+	return 0;
+}
+
+
+static void timedecode(const char *name, void (*decode)(const uint8_t *, const uint8_t *, const uint8_t *, uint8_t *, int))
+{
+	double t = now();
+
+	for (int r = 0; r < DECODEROUNDS; r++)
+		decode(lo, hi, attr, px, ROWS);
+	t = now() - t;
+
+	printf("%-8s %9.1f M rows/s   (%.2f ns/row)\n", name, (double)ROWS * DECODEROUNDS / t * 1e-6,
+	       t * 1e9 / ((double)ROWS * DECODEROUNDS));
+}
+
+
+// random patterns, nametables, palette and sprites, everything on
+static void scene(struct nemu_machine *m)
+{
+	for (size_t i = 0; i < sizeof(chr); i++)
+		chr[i] = rnd();
+	for (int i = 0; i < 8; i++)
+		m->cart.chrbank[i] = chr + i * 0x400;
+	m->cart.mirror = MIRRORVERTICAL;
+
+	ppuinit(m);
+	for (size_t i = 0; i < PPUVRAM; i++)
+		m->vram[i] = rnd();
+	for (size_t i = 0; i < sizeof(m->oam); i++)
+		m->oam[i] = rnd();
+	for (size_t i = 0; i < sizeof(m->ppu.palette); i++)
+		m->ppu.palette[i] = rnd() & 0x3F;
+	m->ppu.ctrl = CTRLBG;
+	m->ppu.mask = MASKBG | MASKSPRITES | MASKBGLEFT | MASKSPRLEFT;
+}
+
+
+// frames with the scroll and sprite size moving every frame
+static void timeframes(struct nemu_machine *m, const char *name, int frames)
+{
+	uint32_t h = 2166136261u;
+	double t = 0;
+
+	seed = 0x2C02;
+	scene(m);
+
+	for (int f = 0; f < frames; f++) {
+		m->ppu.t = rnd() | (rnd() & 0x7F) << 8;
+		m->ppu.x = rnd() & 7;
+		m->ppu.ctrl ^= f % 3 ? 0 : CTRLTALL;
+		m->cpu.clock_count += FRAME;
+
+		double start = now();
+
+		ppusync(m);
+		t += now() - start;
+
+		if (m->screen) {
+			for (int y = 0; y < PPUHEIGHT; y++)
+				for (int x = 0; x < PPUWIDTH; x++)
+					h = (h ^ screen[y][x]) * 16777619u;
+		}
+	}
+
+	printf("%-8s %-8s %6d frames %9.1f frames/s %7.2f us/frame  %08x\n", name, decodername(), frames,
+	       frames / t, t * 1e6 / frames, m->screen ? h : 0);
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct nemu_machine *m = nemu_new();
+	int frames = FRAMES;
+
+	if (!m)
+		return 1;
+	if (argc > 1)
+		frames = atoi(argv[1]);
+
+	if (check())
+		return 1;
+	timedecode("ref", ppudecoderef);
+	timedecode(decodername(), ppudecode);
+
+	nemu_set_screen(m, &screen[0][0], PPUWIDTH);
+	timeframes(m, "drawn", frames);
+	nemu_set_screen(m, NULL, 0);
+	timeframes(m, "headless", frames);
+
+	nemu_free(m);
+	return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef BLOCK_H_
+#define BLOCK_H_
+
+#include <stdint.h>
+
+#include "bus.h"
+
+// predecoded basic blocks for CORE_BLOCK. a block is a straight run of
+// instructions inside one page, ending at the first branch, jump, call,
+// return or break. blocks are found by pc in a direct mapped table and
+// are valid while the generation of their page is unchanged; the bus
+// bumps it whenever the page is remapped or written to.
+
+#define BLOCKMAX   16      // instructions per block
+#define BLOCKSLOTS 2048    // direct mapped on pc
+
+struct blockop {
+	uint16_t operand;      // resolved address, immediate's address or branch offset
+	uint8_t opcode;
+	uint8_t len;           // instruction length in bytes
+};
+
+struct block {
+	uint32_t gen;          // generation of the page it was decoded from
+	uint16_t pc;           // address of the first instruction
+	uint8_t n;             // instructions in op[], 0 for an empty slot
+	struct blockop op[BLOCKMAX];
+};
+
+struct blockcache {
+	uint32_t gen[BUSPAGES];
+	struct block slot[BLOCKSLOTS];
+};
+
+#endif // BLOCK_H_
@@ -1,24 +1,230 @@
-#include "bus.h"
+#include <stddef.h>
+#include <string.h>
 
+#include "machine.h"
 
-void buswrite(uint16_t addr, uint8_t data)
+
+void businit(struct nemu_machine *m)
+{
+	for (int i = 0; i < BUSPAGES; i++)
+		m->bus.page[i] = (struct buspage){ NULL, NULL, NULL, NULL, 0, 0x0000, 0xFFFF, 0 };
+	memset(m->bus.dirty, 0xFF, sizeof(m->bus.dirty));
+	memset(m->bus.gen, 0, sizeof(m->bus.gen));
+}
+
+
+// what is at page now isn't what was there, whoever cached it
+void bustouch(struct nemu_machine *m, uint8_t page)
+{
+	m->bus.dirty[page >> 3] |= 1 << (page & 7);
+	m->bus.gen[page]++;
+	blockinvalidate(m, page);
+}
+
+
+// map [startaddr, endaddr] onto host memory. both ends are rounded out to
+// whole pages, mem points at the byte backing startaddr.
+void busmapmem(struct nemu_machine *m, uint16_t startaddr, uint16_t endaddr, uint8_t *mem, _Bool writable)
+{
+	for (int page = startaddr >> 8; page <= endaddr >> 8; page++) {
+		uint8_t *base = mem + (page - (startaddr >> 8)) * BUSPAGESIZE;
+
+		// ram shared with forks is ours again first
+		if (base >= m->ram && base < m->ram + RAMSIZE)
+			ramown(m, (base - m->ram) / BUSPAGESIZE);
+		m->bus.page[page].rd = base;
+		m->bus.page[page].wr = writable ? base : NULL;
+		m->bus.page[page].dev = NULL;
+		m->bus.page[page].mem = writable ? base : NULL;
+		m->bus.page[page].watch = 0;
+		m->bus.page[page].base = 0x0000;
+		m->bus.page[page].mask = 0xFFFF;
+		m->bus.page[page].mirrored = 0;
+		bustouch(m, page);
+
+		// the same memory mapped twice is a mirror as well
+		for (int i = 0; writable && i < BUSPAGES; i++) {
+			if (i != page && m->bus.page[i].mem == base)
+				m->bus.page[i].mirrored = m->bus.page[page].mirrored = 1;
+		}
+	}
+}
+
+
+// route every page touched by dev through its callbacks. devices sharing a
+// page have to be combined into one devonbus by the caller.
+void busmapio(struct nemu_machine *m, const struct devonbus *dev)
+{
+	for (int page = dev->startaddr >> 8; page <= dev->endaddr >> 8; page++) {
+		m->bus.page[page].rd = NULL;
+		m->bus.page[page].wr = NULL;
+		m->bus.page[page].dev = dev;
+		m->bus.page[page].mem = NULL;
+		m->bus.page[page].watch = 0;
+		m->bus.page[page].base = 0x0000;
+		m->bus.page[page].mask = 0xFFFF;
+		m->bus.page[page].mirrored = 0;
+		bustouch(m, page);
+	}
+}
+
+
+// map [startaddr, endaddr] read only onto rom and send writes to dev, for
+// cartridge rom with mapper registers behind it. reads never leave the fast
+// path, a bank switch is a call to this for the pages of the bank.
+void busmaprom(struct nemu_machine *m, uint16_t startaddr, uint16_t endaddr, const uint8_t *rom, const struct devonbus *dev)
+{
+	for (int page = startaddr >> 8; page <= endaddr >> 8; page++) {
+		// the bus never writes through rd, dropping const is safe
+		m->bus.page[page].rd = (uint8_t *)rom + (page - (startaddr >> 8)) * BUSPAGESIZE;
+		m->bus.page[page].wr = NULL;
+		m->bus.page[page].dev = dev;
+		m->bus.page[page].mem = NULL;
+		m->bus.page[page].watch = 0;
+		m->bus.page[page].base = 0x0000;
+		m->bus.page[page].mask = 0xFFFF;
+		m->bus.page[page].mirrored = 0;
+		bustouch(m, page);
+	}
+}
+
+
+// make [startaddr, endaddr] repeat whatever is mapped at the first size
+// bytes of it. size is a power of two and startaddr a multiple of it. the
+// mirror pages get copies of the original page entries, so memory mirrors
+// cost nothing per access. mirrors smaller than a page only work for io,
+// the slow path folds their addresses so devices only ever see the
+// original range.
+void busmirror(struct nemu_machine *m, uint16_t startaddr, uint16_t endaddr, uint16_t size)
 {
-	for (int i = 0; i < sizeof(devlist)/sizeof(devlist[0]); i++) {
-		if (devlist[i].startaddr <= addr && addr <= devlist[i].endaddr) {
-			devlist[i].write(addr, data);
-			return;
+	int first = startaddr >> 8;
+	int n = size >= BUSPAGESIZE ? size >> 8 : 1;
+
+	for (int page = first; page <= endaddr >> 8; page++) {
+		if (page >= first + n) {
+			struct buspage *p = &m->bus.page[first + (page - first) % n];
+
+			p->mirrored = 1;
+			m->bus.page[page] = *p;
+			bustouch(m, page);
+		}
+		m->bus.page[page].base = startaddr;
+		m->bus.page[page].mask = size - 1;
+	}
+}
+
+
+// trap the next write to a writable memory page. mirrors of it share the
+// memory, so they are watched along with it.
+void buswatch(struct nemu_machine *m, uint8_t page, uint8_t watch)
+{
+	uint8_t *mem = m->bus.page[page].mem;
+	int all = m->bus.page[page].mirrored;
+
+	if (!mem)
+		return;
+
+	for (int i = all ? 0 : page; i <= (all ? BUSPAGES - 1 : page); i++) {
+		struct buspage *p = &m->bus.page[i];
+
+		if (p->mem == mem) {
+			p->watch |= watch;
+			p->wr = NULL;
 		}
 	}
 }
 
 
-uint8_t busread(uint16_t addr, _Bool readonly)
+// every writable page traps its next write, which marks it and its
+// mirrors dirty
+void busclean(struct nemu_machine *m)
 {
-	for (int i = 0; i < sizeof(devlist)/sizeof(devlist[0]); i++) {
-		if (devlist[i].startaddr <= addr && addr <= devlist[i].endaddr) {
-			return devlist[i].read(addr);
+	memset(m->bus.dirty, 0, sizeof(m->bus.dirty));
+
+	for (int i = 0; i < BUSPAGES; i++) {
+		struct buspage *p = &m->bus.page[i];
+
+		if (p->mem) {
+			p->watch |= WATCHDIRTY;
+			p->wr = NULL;
 		}
 	}
+}
+
+
+uint8_t busreadio(struct nemu_machine *m, uint16_t addr, _Bool readonly)
+{
+	const struct buspage *p = &m->bus.page[addr >> 8];
+
+	(void)readonly;    // devices don't tell a peek from a read yet
+
+	if (p->dev && p->dev->read)
+		return p->dev->read(m, p->base | (addr & p->mask));
 
 	return 0x00;
 }
+
+
+void buswriteio(struct nemu_machine *m, uint16_t addr, uint8_t data)
+{
+	struct buspage *p = &m->bus.page[addr >> 8];
+
+	if (p->watch) {
+		uint8_t *mem = p->mem;
+		uint8_t watch = p->watch;
+		int page = addr >> 8;
+		int all = p->mirrored;
+
+		if (watch & WATCHCOW)
+			ramown(m, (mem - m->ram) / BUSPAGESIZE);
+		for (int i = all ? 0 : page; i <= (all ? BUSPAGES - 1 : page); i++) {
+			struct buspage *q = &m->bus.page[i];
+
+			if (q->mem != mem)
+				continue;
+			if (watch & WATCHCODE)
+				blockinvalidate(m, i);
+			if (watch & WATCHDIRTY)
+				m->bus.dirty[i >> 3] |= 1 << (i & 7);
+			m->bus.gen[i]++;
+			q->watch = 0;
+			q->wr = mem;
+		}
+
+		mem[addr & 0xFF] = data;
+		return;
+	}
+
+	if (p->dev && p->dev->write)
+		p->dev->write(m, p->base | (addr & p->mask), data);
+}
+
+
+_Bool busdirty(struct nemu_machine *m, uint8_t page)
+{
+	return m->bus.dirty[page >> 3] >> (page & 7) & 1;
+}
+
+
+// a page already watched for it has had no write since the last call
+uint32_t busgen(struct nemu_machine *m, uint8_t page)
+{
+	if (!(m->bus.page[page].watch & WATCHGEN))
+		buswatch(m, page, WATCHGEN);
+	return m->bus.gen[page];
+}
+
+
+// busgen() for every page in one pass
+void busgens(struct nemu_machine *m, uint32_t *gen)
+{
+	for (int i = 0; i < BUSPAGES; i++) {
+		struct buspage *p = &m->bus.page[i];
+
+		if (p->mem) {
+			p->watch |= WATCHGEN;
+			p->wr = NULL;
+		}
+	}
+	memcpy(gen, m->bus.gen, sizeof(m->bus.gen));
+}
@@ -3,21 +3,73 @@
 
 #include <stdint.h>
 
-#include "ram.h"
+#define BUSPAGES    256
+#define BUSPAGESIZE 256
+
+struct nemu_machine;
 
 struct devonbus {
 	uint16_t startaddr;
 	uint16_t endaddr;
-	void (*write) (uint16_t, uint8_t);
-	uint8_t (*read) (uint16_t);
+	void (*write) (struct nemu_machine *, uint16_t, uint8_t);
+	uint8_t (*read) (struct nemu_machine *, uint16_t);
+	// reading addr again returns the same and changes nothing until the
+	// next scheduled event, so an idle loop may poll it. may schedule an
+	// event to make it so. NULL for never.
+	_Bool (*steady) (struct nemu_machine *, uint16_t);
+};
+
+// one entry per 256 byte page of the address space. plain memory pages
+// carry host pointers and never leave the fast path, io pages go through
+// the device callbacks.
+struct buspage {
+	uint8_t *rd;                     // host memory for reads, NULL for io
+	uint8_t *wr;                     // host memory for writes, NULL for io, rom or watched
+	const struct devonbus *dev;      // device handling io accesses
+	uint8_t *mem;                    // host memory backing a writable page
+	uint8_t watch;                   // why writes to mem are trapped
+	uint16_t base;                   // io addresses are folded to base | (addr & mask)
+	uint16_t mask;                   // before the device sees them, see busmirror()
+	uint8_t mirrored;                // other pages may share mem, watches have to find them
 };
 
-static struct devonbus devlist[] = {
-	{ 0x0000, 0xFFFF, ramwrite, ramread },
+// a watched page takes its next write through buswriteio(), which lets the
+// watchers know and puts the page back on the fast path
+enum BUSWATCH {
+	WATCHCODE = (1 << 0),    // the block cache holds code from this page
+	WATCHDIRTY = (1 << 1),   // not written since busclean()
+	WATCHGEN = (1 << 2),     // not written since busgen()
+	WATCHCOW = (1 << 3),     // reads ram shared with forks, see ramown()
 };
 
+// dirty tracking costs the fast path nothing: a page is only watched
+// until its first write, which marks it and moves its generation on. the
+// bitmap has one owner that clears it with busclean(), the rewind ring.
+// generations can be held by any number of users, a page whose generation
+// is what busgen() returned is unchanged since.
+struct bus {
+	struct buspage page[BUSPAGES];
+	uint8_t dirty[BUSPAGES / 8];    // pages written or remapped since busclean()
+	uint32_t gen[BUSPAGES];         // counts remaps and writes after a busgen()
+};
+
+
+void businit(struct nemu_machine *m);     // unmap the whole address space
+void busmapmem(struct nemu_machine *m, uint16_t startaddr, uint16_t endaddr, uint8_t *mem, _Bool writable);
+void busmapio(struct nemu_machine *m, const struct devonbus *dev);
+void busmaprom(struct nemu_machine *m, uint16_t startaddr, uint16_t endaddr, const uint8_t *rom, const struct devonbus *dev);
+void busmirror(struct nemu_machine *m, uint16_t startaddr, uint16_t endaddr, uint16_t size);
+void buswatch(struct nemu_machine *m, uint8_t page, uint8_t watch);
+void busclean(struct nemu_machine *m);    // mark every page clean and watch for writes
+_Bool busdirty(struct nemu_machine *m, uint8_t page);      // written or remapped since busclean()
+uint32_t busgen(struct nemu_machine *m, uint8_t page);     // its generation, watching for the next write
+void busgens(struct nemu_machine *m, uint32_t *gen);       // all BUSPAGES of them
+void bustouch(struct nemu_machine *m, uint8_t page);       // its memory changed behind the bus' back
+
+uint8_t busreadio(struct nemu_machine *m, uint16_t addr, _Bool readonly);
+void buswriteio(struct nemu_machine *m, uint16_t addr, uint8_t data);
 
-void buswrite(uint16_t addr, uint8_t data);
-uint8_t busread(uint16_t addr, _Bool readonly);
+// busread() and buswrite() are inlined from machine.h, they need the
+// machine layout
 
 #endif // BUS_H_
@@ -0,0 +1,194 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "machine.h"
+#include "mapper.h"
+
+
+// NES 2.0 sizes are either a plain count of units or, with the msb nibble
+// all ones, 2^exponent * (multiplier*2 + 1) bytes. exponents past 2^32
+// can't be in any file and would overflow, they come back as SIZE_MAX.
+static size_t nes2size(uint8_t lsb, uint8_t msb, size_t unit)
+{
+	if (msb == 0x0F) {
+		if ((lsb >> 2) > 32)
+			return SIZE_MAX;
+		return ((size_t)1 << (lsb >> 2)) * ((lsb & 0x03) * 2 + 1);
+	}
+
+	return ((size_t)msb << 8 | lsb) * unit;
+}
+
+
+static int parse(struct cart *c)
+{
+	const uint8_t *h = c->file;
+	size_t off = CARTHEADER;
+
+	if (c->filesize < CARTHEADER || memcmp(h, "NES\x1A", 4) != 0)
+		goto bad;
+
+	c->nes2 = (h[7] & 0x0C) == 0x08;
+	c->mirror = (h[6] & 0x08) ? MIRRORFOUR : (h[6] & 0x01) ? MIRRORVERTICAL : MIRRORHORIZONTAL;
+	c->battery = (h[6] & 0x02) != 0;
+	c->prgramsize = 0x2000;
+
+	if (c->nes2) {
+		c->mapper = (h[6] >> 4) | (h[7] & 0xF0) | (h[8] & 0x0F) << 8;
+		c->submapper = h[8] >> 4;
+		c->prgsize = nes2size(h[4], h[9] & 0x0F, 0x4000);
+		c->chrsize = nes2size(h[5], h[9] >> 4, 0x2000);
+		c->prgramsize = (h[10] & 0x0F) ? 64 << (h[10] & 0x0F) : 0;
+	} else {
+		// old dumping tools left junk in bytes 7-15, only trust the
+		// upper mapper nibble when the tail is clean
+		c->mapper = h[6] >> 4;
+		if (h[12] == 0 && h[13] == 0 && h[14] == 0 && h[15] == 0)
+			c->mapper |= h[7] & 0xF0;
+		c->prgsize = h[4] * 0x4000;
+		c->chrsize = h[5] * 0x2000;
+	}
+
+	if (h[6] & 0x04) {
+		c->trainer = h + off;
+		off += 512;
+	}
+
+	// each size against what is left of the file on its own, a sum could
+	// wrap. prg is mapped in whole 8K windows, chr in 1K ones.
+	if (off > c->filesize || c->prgsize == 0 || c->prgsize % 0x2000 != 0 ||
+	    c->prgsize > c->filesize - off || c->chrsize % 0x400 != 0 ||
+	    c->chrsize > c->filesize - off - c->prgsize)
+		goto bad;
+
+	c->prg = h + off;
+	c->chr = c->chrsize ? h + off + c->prgsize : NULL;
+
+	return 0;
+
+bad:
+	errno = EINVAL;
+	return -1;
+}
+
+
+int cartopen(struct cart *c, const char *path)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	memset(c, 0, sizeof(*c));
+
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size < CARTHEADER) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	int err = errno;
+
+	close(fd);
+	if (p == MAP_FAILED) {
+		errno = err;
+		return -1;
+	}
+
+	c->file = p;
+	c->filesize = st.st_size;
+
+	if (parse(c) < 0) {
+		cartclose(c);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+// the last machine holding the file unmaps it
+void cartclose(struct cart *c)
+{
+	if (c->file && (!c->users || atomic_fetch_sub(c->users, 1) == 1)) {
+		munmap((void *)c->file, c->filesize);
+		free(c->users);
+	}
+
+	c->file = NULL;
+	c->users = NULL;
+}
+
+
+int cartdup(struct cart *c, struct cart *from)
+{
+	if (from->file && !from->users) {
+		if (!(from->users = malloc(sizeof(*from->users))))
+			return -1;
+		atomic_init(from->users, 1);
+	}
+
+	memcpy(c, from, offsetof(struct cart, chrram));
+	if (c->file)
+		atomic_fetch_add(c->users, 1);
+
+	// chr ram is the fork's own, if it is used
+	if (c->file && !c->chr)
+		memcpy(c->chrram, from->chrram, CARTCHRRAM);
+	for (int i = 0; i < 8; i++) {
+		if (from->chrbank[i] >= from->chrram && from->chrbank[i] < from->chrram + CARTCHRRAM)
+			c->chrbank[i] = c->chrram + (from->chrbank[i] - from->chrram);
+	}
+
+	return 0;
+}
+
+
+// bank switching is up to the mapper, see mapper.c
+int cartmap(struct nemu_machine *m, struct cart *c)
+{
+	c->hw = mapperfind(c->mapper);
+	if (!c->hw) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	if (c->trainer)
+		memcpy(m->ram + 0x7000, c->trainer, 512);
+
+	memset(&c->regs, 0, sizeof(c->regs));
+	cpuirqline(m, IRQMAPPER, 0);
+	if (c->hw->init)
+		c->hw->init(m);
+	c->hw->banks(m);
+
+	return 0;
+}
+
+
+void cartscanline(struct nemu_machine *m)
+{
+	if (m->cart.hw && m->cart.hw->scanline)
+		m->cart.hw->scanline(m);
+}
+
+
+// the counter is only clocked while the ppu renders
+_Bool cartcanirq(struct nemu_machine *m)
+{
+	return m->cart.hw && m->cart.hw->scanline && m->cart.regs.irqenable &&
+	       (m->ppu.mask & (MASKBG | MASKSPRITES));
+}
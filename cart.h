@@ -0,0 +1,72 @@
+#ifndef CART_H_
+#define CART_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// an iNES or NES 2.0 cartridge. the file is mapped read only and prg/chr
+// point straight into it, so nothing is copied and every machine running
+// the same rom shares the page cache.
+
+#define CARTHEADER 16
+#define CARTCHRRAM 0x2000    // chr ram for carts without chr rom
+
+enum CARTMIRROR {
+	MIRRORHORIZONTAL,
+	MIRRORVERTICAL,
+	MIRRORFOUR,
+	MIRRORSINGLELO,    // one screen, set by the mapper
+	MIRRORSINGLEHI,
+};
+
+struct mapper;
+
+// registers of whichever mapper the cart has
+struct mapperregs {
+	uint8_t reg[8];        // bank registers
+	uint8_t select;        // mmc3 bank select
+	uint8_t shift;         // mmc1 serial port
+	uint8_t nshift;
+	uint8_t control;       // mmc1 control
+	uint8_t irqlatch;      // mmc3 scanline counter
+	uint8_t irqcounter;
+	_Bool irqreload;
+	_Bool irqenable;
+};
+
+struct cart {
+	const uint8_t *file;       // the whole mapped file, NULL if no cart
+	size_t filesize;
+	atomic_uint *users;        // machines sharing the mapping since a nemu_fork(), NULL for one
+
+	const uint8_t *prg;
+	size_t prgsize;
+	const uint8_t *chr;        // NULL with chr ram
+	size_t chrsize;
+	const uint8_t *trainer;    // 512 bytes for $7000, or NULL
+
+	uint16_t mapper;
+	uint8_t submapper;         // NES 2.0 only
+	uint8_t mirror;            // CARTMIRROR
+	_Bool battery;
+	_Bool nes2;
+	size_t prgramsize;         // from a NES 2.0 header, 8K otherwise
+
+	const struct mapper *hw;
+	struct mapperregs regs;
+	const uint8_t *chrbank[8];    // 1K windows of ppu $0000-$1FFF, for the ppu
+
+	uint8_t chrram[CARTCHRRAM];
+};
+
+struct nemu_machine;
+
+int cartopen(struct cart *c, const char *path);          // 0 or -1 with errno set
+void cartclose(struct cart *c);
+int cartdup(struct cart *c, struct cart *from);          // for a fork, sharing the file. 0 or -1 with errno set
+int cartmap(struct nemu_machine *m, struct cart *c);      // put the cart on the bus, -1 with errno set
+void cartscanline(struct nemu_machine *m);                 // the ppu finished a rendered scanline
+_Bool cartcanirq(struct nemu_machine *m);                  // the scanline counter may raise irq
+
+#endif // CART_H_
@@ -1,783 +1,1559 @@
-#include "cpu.h"
+#include <string.h>
 
+#include "machine.h"
+#include "opcodes.h"
 
-uint8_t fetched      = 0x00;
-uint16_t temp        = 0x0000;
-uint16_t addr_abs    = 0x0000;
-uint16_t addr_rel    = 0x00;
-uint8_t  opcode      = 0x00;
-uint8_t  cycles      = 0;
-uint32_t clock_count = 0;
 
+static uint8_t getflag(struct cpu *cpu, enum FLAGS6502 f);          // get status flag
+static void    setflag(struct cpu *cpu, enum FLAGS6502 f, _Bool v);    // set status flag
+static void    setnz(struct cpu *cpu, uint8_t v);                       // set Z and N from a result
+static uint8_t getstatus(struct cpu *cpu);                              // status with lazy flags folded in
+static void    setstatus(struct cpu *cpu, uint8_t v);
 
-uint8_t getflag(enum FLAGS6502 f);          // get status flag
-void    setflag(enum FLAGS6502 f, _Bool v);    // set status flag
+static uint8_t fetch(struct cpu *cpu);
+
+
+static inline uint8_t read(struct cpu *cpu, uint16_t addr)
+{
+	return busread(cpu->m, addr, 0);
+}
+
+
+static inline void write(struct cpu *cpu, uint16_t addr, uint8_t data)
+{
+	buswrite(cpu->m, addr, data);
+}
 
-uint8_t fetch();
-uint8_t read(uint16_t addr);
-void    write(uint16_t addr, uint8_t data);
 
 // addressing modes ==========
-uint8_t IMP();	uint8_t IMM();
-uint8_t ZP0();	uint8_t ZPX();
-uint8_t ZPY();	uint8_t REL();
-uint8_t ABS();	uint8_t ABX();
-uint8_t ABY();	uint8_t IND();
-uint8_t IZX();	uint8_t IZY();
+static uint8_t IMP(struct cpu *);	static uint8_t IMM(struct cpu *);
+static uint8_t ZP0(struct cpu *);	static uint8_t ZPX(struct cpu *);
+static uint8_t ZPY(struct cpu *);	static uint8_t REL(struct cpu *);
+static uint8_t ABS(struct cpu *);	static uint8_t ABX(struct cpu *);
+static uint8_t ABY(struct cpu *);	static uint8_t IND(struct cpu *);
+static uint8_t IZX(struct cpu *);	static uint8_t IZY(struct cpu *);
 
 // opcodes ===================================================
-uint8_t ADC();	uint8_t AND();	uint8_t ASL();	uint8_t BCC();
-uint8_t BCS();	uint8_t BEQ();	uint8_t BIT();	uint8_t BMI();
-uint8_t BNE();	uint8_t BPL();	uint8_t BRK();	uint8_t BVC();
-uint8_t BVS();	uint8_t CLC();	uint8_t CLD();	uint8_t CLI();
-uint8_t CLV();	uint8_t CMP();	uint8_t CPX();	uint8_t CPY();
-uint8_t DEC();	uint8_t DEX();	uint8_t DEY();	uint8_t EOR();
-uint8_t INC();	uint8_t INX();	uint8_t INY();	uint8_t JMP();
-uint8_t JSR();	uint8_t LDA();	uint8_t LDX();	uint8_t LDY();
-uint8_t LSR();	uint8_t NOP();	uint8_t ORA();	uint8_t PHA();
-uint8_t PHP();	uint8_t PLA();	uint8_t PLP();	uint8_t ROL();
-uint8_t ROR();	uint8_t RTI();	uint8_t RTS();	uint8_t SBC();
-uint8_t SEC();	uint8_t SED();	uint8_t SEI();	uint8_t STA();
-uint8_t STX();	uint8_t STY();	uint8_t TAX();	uint8_t TAY();
-uint8_t TSX();	uint8_t TXA();	uint8_t TXS();	uint8_t TYA();
-
-uint8_t XXX(); // trap for all unofficial opcodes
-
-
-struct instruction {
-	char *name;
-	uint8_t (*operate)(void);
-	uint8_t (*addrmode)(void);
-	uint8_t cycles;
+static uint8_t ADC(struct cpu *);	static uint8_t AND(struct cpu *);	static uint8_t ASL(struct cpu *);	static uint8_t BCC(struct cpu *);
+static uint8_t BCS(struct cpu *);	static uint8_t BEQ(struct cpu *);	static uint8_t BIT(struct cpu *);	static uint8_t BMI(struct cpu *);
+static uint8_t BNE(struct cpu *);	static uint8_t BPL(struct cpu *);	static uint8_t BRK(struct cpu *);	static uint8_t BVC(struct cpu *);
+static uint8_t BVS(struct cpu *);	static uint8_t CLC(struct cpu *);	static uint8_t CLD(struct cpu *);	static uint8_t CLI(struct cpu *);
+static uint8_t CLV(struct cpu *);	static uint8_t CMP(struct cpu *);	static uint8_t CPX(struct cpu *);	static uint8_t CPY(struct cpu *);
+static uint8_t DEC(struct cpu *);	static uint8_t DEX(struct cpu *);	static uint8_t DEY(struct cpu *);	static uint8_t EOR(struct cpu *);
+static uint8_t INC(struct cpu *);	static uint8_t INX(struct cpu *);	static uint8_t INY(struct cpu *);	static uint8_t JMP(struct cpu *);
+static uint8_t JSR(struct cpu *);	static uint8_t LDA(struct cpu *);	static uint8_t LDX(struct cpu *);	static uint8_t LDY(struct cpu *);
+static uint8_t LSR(struct cpu *);	static uint8_t NOP(struct cpu *);	static uint8_t ORA(struct cpu *);	static uint8_t PHA(struct cpu *);
+static uint8_t PHP(struct cpu *);	static uint8_t PLA(struct cpu *);	static uint8_t PLP(struct cpu *);	static uint8_t ROL(struct cpu *);
+static uint8_t ROR(struct cpu *);	static uint8_t RTI(struct cpu *);	static uint8_t RTS(struct cpu *);	static uint8_t SBC(struct cpu *);
+static uint8_t SEC(struct cpu *);	static uint8_t SED(struct cpu *);	static uint8_t SEI(struct cpu *);	static uint8_t STA(struct cpu *);
+static uint8_t STX(struct cpu *);	static uint8_t STY(struct cpu *);	static uint8_t TAX(struct cpu *);	static uint8_t TAY(struct cpu *);
+static uint8_t TSX(struct cpu *);	static uint8_t TXA(struct cpu *);	static uint8_t TXS(struct cpu *);	static uint8_t TYA(struct cpu *);
+
+static uint8_t XXX(struct cpu *); // trap for all unofficial opcodes
+
+#if NEMU_CORE == CORE_BLOCK
+// predecoded addressing modes ==========
+static uint8_t pIMP(struct cpu *, uint16_t);	static uint8_t pIMM(struct cpu *, uint16_t);
+static uint8_t pZP0(struct cpu *, uint16_t);	static uint8_t pZPX(struct cpu *, uint16_t);
+static uint8_t pZPY(struct cpu *, uint16_t);	static uint8_t pREL(struct cpu *, uint16_t);
+static uint8_t pABS(struct cpu *, uint16_t);	static uint8_t pABX(struct cpu *, uint16_t);
+static uint8_t pABY(struct cpu *, uint16_t);	static uint8_t pIND(struct cpu *, uint16_t);
+static uint8_t pIZX(struct cpu *, uint16_t);	static uint8_t pIZY(struct cpu *, uint16_t);
+
+static const struct block *blockfind(struct nemu_machine *m, uint16_t pc, _Bool uncached, struct block *tmp);
+#endif
+
+
+const struct instruction lookup[256] = {
+#define OP(code, name, operate, addrmode, cycles) { name, operate, addrmode, cycles, #addrmode },
+	OPCODES
+#undef OP
 };
 
-struct instruction lookup[] = {
-	{ "BRK", BRK, IMM, 7 },{ "ORA", ORA, IZX, 6 },{ "???", XXX, IMP, 2 },{ "???", XXX, IMP, 8 },{ "???", NOP, IMP, 3 },{ "ORA", ORA, ZP0, 3 },{ "ASL", ASL, ZP0, 5 },{ "???", XXX, IMP, 5 },{ "PHP", PHP, IMP, 3 },{ "ORA", ORA, IMM, 2 },{ "ASL", ASL, IMP, 2 },{ "???", XXX, IMP, 2 },{ "???", NOP, IMP, 4 },{ "ORA", ORA, ABS, 4 },{ "ASL", ASL, ABS, 6 },{ "???", XXX, IMP, 6 },
-	{ "BPL", BPL, REL, 2 },{ "ORA", ORA, IZY, 5 },{ "???", XXX, IMP, 2 },{ "???", XXX, IMP, 8 },{ "???", NOP, IMP, 4 },{ "ORA", ORA, ZPX, 4 },{ "ASL", ASL, ZPX, 6 },{ "???", XXX, IMP, 6 },{ "CLC", CLC, IMP, 2 },{ "ORA", ORA, ABY, 4 },{ "???", NOP, IMP, 2 },{ "???", XXX, IMP, 7 },{ "???", NOP, IMP, 4 },{ "ORA", ORA, ABX, 4 },{ "ASL", ASL, ABX, 7 },{ "???", XXX, IMP, 7 },
-	{ "JSR", JSR, ABS, 6 },{ "AND", AND, IZX, 6 },{ "???", XXX, IMP, 2 },{ "???", XXX, IMP, 8 },{ "BIT", BIT, ZP0, 3 },{ "AND", AND, ZP0, 3 },{ "ROL", ROL, ZP0, 5 },{ "???", XXX, IMP, 5 },{ "PLP", PLP, IMP, 4 },{ "AND", AND, IMM, 2 },{ "ROL", ROL, IMP, 2 },{ "???", XXX, IMP, 2 },{ "BIT", BIT, ABS, 4 },{ "AND", AND, ABS, 4 },{ "ROL", ROL, ABS, 6 },{ "???", XXX, IMP, 6 },
-	{ "BMI", BMI, REL, 2 },{ "AND", AND, IZY, 5 },{ "???", XXX, IMP, 2 },{ "???", XXX, IMP, 8 },{ "???", NOP, IMP, 4 },{ "AND", AND, ZPX, 4 },{ "ROL", ROL, ZPX, 6 },{ "???", XXX, IMP, 6 },{ "SEC", SEC, IMP, 2 },{ "AND", AND, ABY, 4 },{ "???", NOP, IMP, 2 },{ "???", XXX, IMP, 7 },{ "???", NOP, IMP, 4 },{ "AND", AND, ABX, 4 },{ "ROL", ROL, ABX, 7 },{ "???", XXX, IMP, 7 },
-	{ "RTI", RTI, IMP, 6 },{ "EOR", EOR, IZX, 6 },{ "???", XXX, IMP, 2 },{ "???", XXX, IMP, 8 },{ "???", NOP, IMP, 3 },{ "EOR", EOR, ZP0, 3 },{ "LSR", LSR, ZP0, 5 },{ "???", XXX, IMP, 5 },{ "PHA", PHA, IMP, 3 },{ "EOR", EOR, IMM, 2 },{ "LSR", LSR, IMP, 2 },{ "???", XXX, IMP, 2 },{ "JMP", JMP, ABS, 3 },{ "EOR", EOR, ABS, 4 },{ "LSR", LSR, ABS, 6 },{ "???", XXX, IMP, 6 },
-	{ "BVC", BVC, REL, 2 },{ "EOR", EOR, IZY, 5 },{ "???", XXX, IMP, 2 },{ "???", XXX, IMP, 8 },{ "???", NOP, IMP, 4 },{ "EOR", EOR, ZPX, 4 },{ "LSR", LSR, ZPX, 6 },{ "???", XXX, IMP, 6 },{ "CLI", CLI, IMP, 2 },{ "EOR", EOR, ABY, 4 },{ "???", NOP, IMP, 2 },{ "???", XXX, IMP, 7 },{ "???", NOP, IMP, 4 },{ "EOR", EOR, ABX, 4 },{ "LSR", LSR, ABX, 7 },{ "???", XXX, IMP, 7 },
-	{ "RTS", RTS, IMP, 6 },{ "ADC", ADC, IZX, 6 },{ "???", XXX, IMP, 2 },{ "???", XXX, IMP, 8 },{ "???", NOP, IMP, 3 },{ "ADC", ADC, ZP0, 3 },{ "ROR", ROR, ZP0, 5 },{ "???", XXX, IMP, 5 },{ "PLA", PLA, IMP, 4 },{ "ADC", ADC, IMM, 2 },{ "ROR", ROR, IMP, 2 },{ "???", XXX, IMP, 2 },{ "JMP", JMP, IND, 5 },{ "ADC", ADC, ABS, 4 },{ "ROR", ROR, ABS, 6 },{ "???", XXX, IMP, 6 },
-	{ "BVS", BVS, REL, 2 },{ "ADC", ADC, IZY, 5 },{ "???", XXX, IMP, 2 },{ "???", XXX, IMP, 8 },{ "???", NOP, IMP, 4 },{ "ADC", ADC, ZPX, 4 },{ "ROR", ROR, ZPX, 6 },{ "???", XXX, IMP, 6 },{ "SEI", SEI, IMP, 2 },{ "ADC", ADC, ABY, 4 },{ "???", NOP, IMP, 2 },{ "???", XXX, IMP, 7 },{ "???", NOP, IMP, 4 },{ "ADC", ADC, ABX, 4 },{ "ROR", ROR, ABX, 7 },{ "???", XXX, IMP, 7 },
-	{ "???", NOP, IMP, 2 },{ "STA", STA, IZX, 6 },{ "???", NOP, IMP, 2 },{ "???", XXX, IMP, 6 },{ "STY", STY, ZP0, 3 },{ "STA", STA, ZP0, 3 },{ "STX", STX, ZP0, 3 },{ "???", XXX, IMP, 3 },{ "DEY", DEY, IMP, 2 },{ "???", NOP, IMP, 2 },{ "TXA", TXA, IMP, 2 },{ "???", XXX, IMP, 2 },{ "STY", STY, ABS, 4 },{ "STA", STA, ABS, 4 },{ "STX", STX, ABS, 4 },{ "???", XXX, IMP, 4 },
-	{ "BCC", BCC, REL, 2 },{ "STA", STA, IZY, 6 },{ "???", XXX, IMP, 2 },{ "???", XXX, IMP, 6 },{ "STY", STY, ZPX, 4 },{ "STA", STA, ZPX, 4 },{ "STX", STX, ZPY, 4 },{ "???", XXX, IMP, 4 },{ "TYA", TYA, IMP, 2 },{ "STA", STA, ABY, 5 },{ "TXS", TXS, IMP, 2 },{ "???", XXX, IMP, 5 },{ "???", NOP, IMP, 5 },{ "STA", STA, ABX, 5 },{ "???", XXX, IMP, 5 },{ "???", XXX, IMP, 5 },
-	{ "LDY", LDY, IMM, 2 },{ "LDA", LDA, IZX, 6 },{ "LDX", LDX, IMM, 2 },{ "???", XXX, IMP, 6 },{ "LDY", LDY, ZP0, 3 },{ "LDA", LDA, ZP0, 3 },{ "LDX", LDX, ZP0, 3 },{ "???", XXX, IMP, 3 },{ "TAY", TAY, IMP, 2 },{ "LDA", LDA, IMM, 2 },{ "TAX", TAX, IMP, 2 },{ "???", XXX, IMP, 2 },{ "LDY", LDY, ABS, 4 },{ "LDA", LDA, ABS, 4 },{ "LDX", LDX, ABS, 4 },{ "???", XXX, IMP, 4 },
-	{ "BCS", BCS, REL, 2 },{ "LDA", LDA, IZY, 5 },{ "???", XXX, IMP, 2 },{ "???", XXX, IMP, 5 },{ "LDY", LDY, ZPX, 4 },{ "LDA", LDA, ZPX, 4 },{ "LDX", LDX, ZPY, 4 },{ "???", XXX, IMP, 4 },{ "CLV", CLV, IMP, 2 },{ "LDA", LDA, ABY, 4 },{ "TSX", TSX, IMP, 2 },{ "???", XXX, IMP, 4 },{ "LDY", LDY, ABX, 4 },{ "LDA", LDA, ABX, 4 },{ "LDX", LDX, ABY, 4 },{ "???", XXX, IMP, 4 },
-	{ "CPY", CPY, IMM, 2 },{ "CMP", CMP, IZX, 6 },{ "???", NOP, IMP, 2 },{ "???", XXX, IMP, 8 },{ "CPY", CPY, ZP0, 3 },{ "CMP", CMP, ZP0, 3 },{ "DEC", DEC, ZP0, 5 },{ "???", XXX, IMP, 5 },{ "INY", INY, IMP, 2 },{ "CMP", CMP, IMM, 2 },{ "DEX", DEX, IMP, 2 },{ "???", XXX, IMP, 2 },{ "CPY", CPY, ABS, 4 },{ "CMP", CMP, ABS, 4 },{ "DEC", DEC, ABS, 6 },{ "???", XXX, IMP, 6 },
-	{ "BNE", BNE, REL, 2 },{ "CMP", CMP, IZY, 5 },{ "???", XXX, IMP, 2 },{ "???", XXX, IMP, 8 },{ "???", NOP, IMP, 4 },{ "CMP", CMP, ZPX, 4 },{ "DEC", DEC, ZPX, 6 },{ "???", XXX, IMP, 6 },{ "CLD", CLD, IMP, 2 },{ "CMP", CMP, ABY, 4 },{ "NOP", NOP, IMP, 2 },{ "???", XXX, IMP, 7 },{ "???", NOP, IMP, 4 },{ "CMP", CMP, ABX, 4 },{ "DEC", DEC, ABX, 7 },{ "???", XXX, IMP, 7 },
-	{ "CPX", CPX, IMM, 2 },{ "SBC", SBC, IZX, 6 },{ "???", NOP, IMP, 2 },{ "???", XXX, IMP, 8 },{ "CPX", CPX, ZP0, 3 },{ "SBC", SBC, ZP0, 3 },{ "INC", INC, ZP0, 5 },{ "???", XXX, IMP, 5 },{ "INX", INX, IMP, 2 },{ "SBC", SBC, IMM, 2 },{ "NOP", NOP, IMP, 2 },{ "???", SBC, IMP, 2 },{ "CPX", CPX, ABS, 4 },{ "SBC", SBC, ABS, 4 },{ "INC", INC, ABS, 6 },{ "???", XXX, IMP, 6 },
-	{ "BEQ", BEQ, REL, 2 },{ "SBC", SBC, IZY, 5 },{ "???", XXX, IMP, 2 },{ "???", XXX, IMP, 8 },{ "???", NOP, IMP, 4 },{ "SBC", SBC, ZPX, 4 },{ "INC", INC, ZPX, 6 },{ "???", XXX, IMP, 6 },{ "SED", SED, IMP, 2 },{ "SBC", SBC, ABY, 4 },{ "NOP", NOP, IMP, 2 },{ "???", XXX, IMP, 7 },{ "???", NOP, IMP, 4 },{ "SBC", SBC, ABX, 4 },{ "INC", INC, ABX, 7 },{ "???", XXX, IMP, 7 },
-};
 
+void cpureset(struct nemu_machine *m)
+{
+	struct cpu *cpu = &m->cpu;
+
+	cpu->a = 0;
+	cpu->x = 0;
+	cpu->y = 0;
+	cpu->stkp = 0xFD;
+	setstatus(cpu, I | U);    // irqs masked, as the 6502 comes out of reset
+
+	cpu->addr_abs = 0xFFFC;
+	uint16_t lo = read(cpu, cpu->addr_abs);
+	uint16_t hi = read(cpu, cpu->addr_abs + 1);
+	cpu->pc = (hi << 8) | lo;
+
+	cpu->addr_abs = 0x0000;
+	cpu->addr_rel = 0x0000;
+	cpu->fetched = 0x00;
 
-void cpureset()
+	cpu->cycles = 8;
+}
+
+
+void cpuirq(struct nemu_machine *m)
 {
-	cpu.a = 0;
-	cpu.x = 0;
-	cpu.y = 0;
-	cpu.stkp = 0xFD;
-	cpu.status = 0x00 | U;
+	cpuirqline(m, IRQEXTERNAL, 1);
+}
+
+
+void cpuirqline(struct nemu_machine *m, uint8_t source, _Bool held)
+{
+	if (held)
+		m->cpu.irq |= source;
+	else
+		m->cpu.irq &= ~source;
+
+	if (m->cpu.irq)
+		m->cpu.pending |= IRQLINE;
+	else
+		m->cpu.pending &= ~IRQLINE;
+}
+
+
+void cpunmi(struct nemu_machine *m)
+{
+	m->cpu.pending |= NMILINE;
+}
+
+
+void cpuhalt(struct nemu_machine *m)
+{
+	m->cpu.pending |= HALTLINE;
+}
+
+
+// the cpu is halted at the end of the instruction and sits out cycles
+// while the dma has the bus. with align the dma waits for an even cycle
+// to start on, a sprite dma is 513 or 514 cycles that way. it is only
+// added on at the boundary, where the clock is exact, see stalled().
+void cpustall(struct nemu_machine *m, uint16_t cycles, _Bool align)
+{
+	m->cpu.stall += cycles;
+	m->cpu.stallalign |= align;
+	m->cpu.pending |= STALLLINE;
+}
+
+
+void cpubreak(struct nemu_machine *m, uint16_t addr, _Bool on)
+{
+	uint8_t bit = 1 << (addr & 7);
+
+	if (on && !(m->breakpoints[addr >> 3] & bit)) {
+		m->breakpoints[addr >> 3] |= bit;
+		m->cpu.nbreak++;
+	} else if (!on && (m->breakpoints[addr >> 3] & bit)) {
+		m->breakpoints[addr >> 3] &= ~bit;
+		m->cpu.nbreak--;
+	}
+}
+
+
+// push pc and status and jump through vector
+static void interrupt(struct cpu *cpu, uint16_t vector)
+{
+	write(cpu, 0x0100 + cpu->stkp, (cpu->pc >> 8) & 0x00FF);
+	cpu->stkp--;
+	write(cpu, 0x0100 + cpu->stkp, cpu->pc & 0x00FF);
+	cpu->stkp--;
+
+	setflag(cpu, B, 0);
+	setflag(cpu, U, 1);
+	write(cpu, 0x0100 + cpu->stkp, getstatus(cpu));
+	cpu->stkp--;
+	setflag(cpu, I, 1);
+
+	cpu->addr_abs = vector;
+	uint16_t lo = read(cpu, cpu->addr_abs);
+	uint16_t hi = read(cpu, cpu->addr_abs + 1);
+	cpu->pc = (hi << 8) | lo;
+}
+
+
+#ifdef NEMU_TRACE
+// the bytes after the opcode, without poking devices
+static uint8_t peek(struct nemu_machine *m, uint16_t addr)
+{
+	const struct buspage *p = &m->bus.page[addr >> 8];
+
+	return p->rd ? p->rd[addr & 0xFF] : 0x00;
+}
+
+// log the instruction about to run at pc
+static void trace(struct nemu_machine *m, struct cpu *cpu, uint16_t pc, uint8_t opcode)
+{
+	struct tracerecord r = {
+		.clock = m->cpu.clock_count, .pc = pc, .opcode = opcode,
+		.operand = { peek(m, pc + 1), peek(m, pc + 2) },
+		.a = cpu->a, .x = cpu->x, .y = cpu->y, .s = cpu->stkp, .p = getstatus(cpu) | U,
+	};
+
+	traceadd(m->trace, &r);
+}
+#endif
+
+
+// take a pending interrupt if one is due, returns the line serviced
+static uint8_t service(struct cpu *cpu)
+{
+	if (cpu->pending & NMILINE) {
+		cpu->pending &= ~NMILINE;
+		interrupt(cpu, 0xFFFA);
+		cpu->cycles = 8;
+#ifdef NEMU_PROFILE
+		if (cpu->m->profile)
+			profileinterrupt(cpu->m->profile, NMILINE, cpu->pc, cpu->cycles);
+#endif
+		return NMILINE;
+	}
+
+	// the fused cores run on a copy, the sources are kept live in m->cpu.
+	// the line stays up while a device holds it, I keeps it out until then.
+	if ((cpu->pending & IRQLINE) && getflag(cpu, I) == 0) {
+		cpu->m->cpu.irq &= ~IRQEXTERNAL;
+		if (!cpu->m->cpu.irq)
+			cpu->pending &= ~IRQLINE;
+		interrupt(cpu, 0xFFFE);
+		cpu->cycles = 7;
+#ifdef NEMU_PROFILE
+		if (cpu->m->profile)
+			profileinterrupt(cpu->m->profile, IRQLINE, cpu->pc, cpu->cycles);
+#endif
+		return IRQLINE;
+	}
+
+	return 0;
+}
 
-	addr_abs = 0xFFFC;
-	uint16_t lo = read(addr_abs);
-	uint16_t hi = read(addr_abs + 1);
-	cpu.pc = (hi << 8) | lo;
 
-	addr_abs = 0x0000;
-	addr_rel = 0x0000;
-	fetched = 0x00;
+// the cycles a dma asked for, taken at an instruction boundary. it works
+// on m->cpu, where the fused cores keep the lines and the clock live.
+static uint16_t stalled(struct nemu_machine *m)
+{
+	struct cpu *cpu = &m->cpu;
+	uint16_t n = cpu->stall + (cpu->stallalign & cpu->clock_count & 1);
 
-	cycles = 8;
+	cpu->pending &= ~STALLLINE;
+	cpu->stall = 0;
+	cpu->stallalign = 0;
+	return n;
 }
 
 
-void cpuirq()
+// execute one whole instruction, leaves its cycle count in cpu->cycles
+static void step(struct cpu *cpu)
 {
-	if (getflag(I) == 0) {
-		write(0x0100 + cpu.stkp, (cpu.pc >> 8) & 0x00FF);
-		cpu.stkp--;
-		write(0x0100 + cpu.stkp, cpu.pc & 0x00FF);
-		cpu.stkp--;
+#ifdef NEMU_PROFILE
+	uint16_t pc = cpu->pc;
+#endif
+
+	cpu->opcode = read(cpu, cpu->pc);
+#ifdef NEMU_TRACE
+	if (cpu->m->trace)
+		trace(cpu->m, cpu, cpu->pc, cpu->opcode);
+#endif
+	cpu->pc++;
+
+	setflag(cpu, U, 1);
+
+	cpu->cycles = lookup[cpu->opcode].cycles;
 
-		setflag(B, 0);
-		setflag(U, 1);
-		setflag(I, 1);
-		write(0x0100 + cpu.stkp, cpu.status);
-		cpu.stkp--;
+	uint8_t addcycles1 = lookup[cpu->opcode].addrmode(cpu);
+	uint8_t addcycles2 = lookup[cpu->opcode].operate(cpu);
 
-		addr_abs = 0xFFFE;
-		uint16_t lo = read(addr_abs);
-		uint16_t hi = read(addr_abs + 1);
-		cpu.pc = (hi << 8) | lo;
+	cpu->cycles += (addcycles1 & addcycles2);
+	cpu->instructions++;
 
-		cycles = 7;
+#ifdef NEMU_PROFILE
+	if (cpu->m->profile)
+		profileop(cpu->m->profile, pc, cpu->opcode, cpu->cycles, cpu->pc);
+#endif
+}
+
+
+void cputick(struct nemu_machine *m)
+{
+	struct cpu *cpu = &m->cpu;
+
+	if (cpu->cycles == 0) {
+		if (cpu->clock_count >= schednext(&m->sched))
+			schedrun(m);
+		if (cpu->pending & STALLLINE) {
+			cpu->cycles = stalled(m);
+		} else {
+			setstatus(cpu, cpu->status);
+			if (!service(cpu))
+				step(cpu);
+			cpu->status = getstatus(cpu);
+		}
 	}
+
+	cpu->cycles--;
+	cpu->clock_count++;
 }
 
 
-void cpunmi()
+uint8_t cpulen(uint8_t opcode)
 {
-	write(0x0100 + cpu.stkp, (cpu.pc >> 8) & 0x00FF);
-	cpu.stkp--;
-	write(0x0100 + cpu.stkp, cpu.pc & 0x00FF);
-	cpu.stkp--;
+	uint8_t (*mode)(struct cpu *) = lookup[opcode].addrmode;
+
+	if (mode == IMP)
+		return 1;
+	if (mode == ABS || mode == ABX || mode == ABY || mode == IND)
+		return 3;
+	return 2;
+}
 
-	setflag(B, 0);
-	setflag(U, 1);
-	setflag(I, 1);
-	write(0x0100 + cpu.stkp, cpu.status);
-	cpu.stkp--;
 
-	addr_abs = 0xFFFA;
-	uint16_t lo = read(addr_abs);
-	uint16_t hi = read(addr_abs + 1);
-	cpu.pc = (hi << 8) | lo;
+// the run stops at m->cpu.until, the end of its budget or the next event,
+// whichever comes first. a device scheduling an earlier event pulls it in.
+static uint64_t stopat(struct nemu_machine *m, uint64_t end)
+{
+	uint64_t next = schednext(&m->sched);
 
-	cycles = 8;
+	return next < end ? next : end;
 }
 
 
-void cputick()
+// the run got to m->cpu.until: fire the events that are due and move
+// until on to the next stop. 0 once the budget is used up.
+static _Bool reached(struct nemu_machine *m, uint64_t end)
 {
-	if (cycles == 0) {
-		opcode = busread(cpu.pc, 0);
-		cpu.pc++;
+	schedrun(m);
+	m->cpu.until = stopat(m, end);
+	return m->cpu.clock_count < end;
+}
 
-		cycles = lookup[opcode].cycles;
 
-		uint8_t addcycles1 = lookup[opcode].operate();
-		uint8_t addcycles2 = lookup[opcode].addrmode();
+#if NEMU_CORE == CORE_TABLE || defined(NEMU_TRACE) || defined(NEMU_PROFILE)
 
-		cycles += (addcycles1 & addcycles2);
+static uint32_t tablerun(struct nemu_machine *m, uint32_t budget)
+{
+	struct cpu *cpu = &m->cpu;
+	const uint8_t *breakpoints = m->breakpoints;
+	uint64_t start = cpu->clock_count;
+	uint64_t end = start + budget;
+	uint8_t line;
+
+	cpu->until = stopat(m, end);
+	cpu->idleclock = UINT64_MAX;
+
+	// retire whatever cputick left in flight first
+	cpu->clock_count += cpu->cycles;
+	cpu->cycles = 0;
+
+	cpu->stop = CPU_BUDGET;
+	setstatus(cpu, cpu->status);
+
+	for (uint32_t n = 0; ; n++) {
+		// until is live here, the line is for the fused cores
+		cpu->pending &= ~SCHEDLINE;
+		if (cpu->clock_count >= cpu->until) {
+			if (!reached(m, end))
+				break;
+			// an event may have changed what an idle loop reads, it
+			// has to go round again before it can be skipped
+			cpu->idleclock = UINT64_MAX;
+		}
+
+		if (cpu->pending & STALLLINE) {
+			cpu->clock_count += stalled(m);
+			continue;
+		}
+
+		if (cpu->pending & HALTLINE) {
+			cpu->pending &= ~HALTLINE;
+			cpu->stop = CPU_HALT;
+			break;
+		}
+
+		if (cpu->pending && (line = service(cpu))) {
+			cpu->clock_count += cpu->cycles;
+			cpu->cycles = 0;
+			cpu->stop = line == NMILINE ? CPU_NMI : CPU_IRQ;
+			break;
+		}
+
+		// never stop on the instruction we were resumed at
+		if (cpu->nbreak && n && (breakpoints[cpu->pc >> 3] & (1 << (cpu->pc & 7)))) {
+			cpu->stop = CPU_BREAK;
+			break;
+		}
+
+		step(cpu);
+
+		cpu->clock_count += cpu->cycles;
+		cpu->cycles = 0;
 	}
 
-	cycles--;
+	cpu->status = getstatus(cpu);
+	cpu->pending &= ~SCHEDLINE;
+	cpu->until = 0;
+
+	return cpu->clock_count - start;
+}
+
+#endif
+
+
+#if NEMU_CORE == CORE_TABLE
+
+uint32_t cpurun(struct nemu_machine *m, uint32_t budget)
+{
+	return tablerun(m, budget);
+}
+
+#else
+
+// fused cores: every opcode gets its own case with the addressing mode and
+// operation inlined into it, and the registers are a local copy for the
+// duration of the run. devices only ever see m->cpu.pending, stall and
+// clock_count, which stay live. an event scheduled while running
+// raises SCHEDLINE to have the local until picked up again. CORE_BLOCK runs the same cases over
+// predecoded blocks instead of fetching from the bus.
+#define EXEC(code, operate, addrmode, cyc) \
+	c.opcode = code; \
+	c.cycles = cyc; \
+	add1 = addrmode(&c); \
+	add2 = operate(&c); \
+	c.cycles += (add1 & add2); \
+	c.instructions++;
+
+uint32_t cpurun(struct nemu_machine *m, uint32_t budget)
+{
+	struct cpu c = m->cpu;
+	const uint8_t *breakpoints = m->breakpoints;
+	uint64_t start = m->cpu.clock_count;
+	uint64_t end = start + budget;
+	_Bool resumed = 1;
+	uint8_t add1, add2, line;
+#if NEMU_CORE == CORE_BLOCK
+	const struct block *b;
+	const struct blockop *op;
+	struct block tmp;
+#endif
+
+#if NEMU_CORE == CORE_THREADED
+	static const void *dispatch[256] = {
+#define OP(code, name, operate, addrmode, cyc) [code] = &&op##code,
+		OPCODES
+#undef OP
+	};
+#endif
+
+	// traced and profiled runs take the reference core, the fused ones
+	// stay hook free
+#ifdef NEMU_TRACE
+	if (m->trace)
+		return tablerun(m, budget);
+#endif
+#ifdef NEMU_PROFILE
+	if (m->profile)
+		return tablerun(m, budget);
+#endif
+
+	m->cpu.until = c.until = stopat(m, end);
+	c.idleclock = UINT64_MAX;
+
+	// retire whatever cputick left in flight first
+	m->cpu.clock_count += c.cycles;
+	c.cycles = 0;
+
+	c.stop = CPU_BUDGET;
+	setstatus(&c, c.status);
+
+	for (;;) {
+		if (m->cpu.clock_count >= c.until) {
+			if (!reached(m, end))
+				break;
+			c.until = m->cpu.until;
+			c.idleclock = UINT64_MAX;
+		}
+
+		if (m->cpu.pending & SCHEDLINE) {
+			m->cpu.pending &= ~SCHEDLINE;
+			c.until = m->cpu.until;
+			continue;
+		}
+
+		if (m->cpu.pending & STALLLINE) {
+			m->cpu.clock_count += stalled(m);
+			continue;
+		}
+
+		if (m->cpu.pending & HALTLINE) {
+			m->cpu.pending &= ~HALTLINE;
+			c.stop = CPU_HALT;
+			break;
+		}
+
+		if (m->cpu.pending) {
+			c.pending = m->cpu.pending;
+			line = service(&c);
+			m->cpu.pending = c.pending;
+
+			if (line) {
+				m->cpu.clock_count += c.cycles;
+				c.cycles = 0;
+				c.stop = line == NMILINE ? CPU_NMI : CPU_IRQ;
+				break;
+			}
+		}
+
+		// never stop on the instruction we were resumed at
+		if (c.nbreak && !resumed && (breakpoints[c.pc >> 3] & (1 << (c.pc & 7)))) {
+			c.stop = CPU_BREAK;
+			break;
+		}
+		resumed = 0;
+
+#if NEMU_CORE == CORE_THREADED
+next:
+		c.opcode = read(&c, c.pc);
+		c.pc++;
+		c.status |= U;
+		goto *dispatch[c.opcode];
+
+		// each handler accounts its cycles and dispatches the next opcode
+		// itself unless something needs the checks above
+#define OP(code, name, operate, addrmode, cyc) \
+	op##code: \
+		EXEC(code, operate, addrmode, cyc) \
+		m->cpu.clock_count += c.cycles; \
+		c.cycles = 0; \
+		if (m->cpu.clock_count < c.until && !(m->cpu.pending | c.nbreak)) \
+			goto next; \
+		continue;
+
+		OPCODES
+#undef OP
+#elif NEMU_CORE == CORE_BLOCK
+		b = blockfind(m, c.pc, c.nbreak, &tmp);
+
+		for (op = b->op; op < b->op + b->n; op++) {
+			c.pc += op->len;
+			c.status |= U;
+
+			switch (op->opcode) {
+#define OP(code, name, operate, addrmode, cyc) \
+			case code: \
+				c.opcode = code; \
+				c.cycles = cyc; \
+				add1 = p##addrmode(&c, op->operand); \
+				add2 = operate(&c); \
+				c.cycles += (add1 & add2); \
+				c.instructions++; \
+				break;
+
+				OPCODES
+#undef OP
+			}
+
+			m->cpu.clock_count += c.cycles;
+			c.cycles = 0;
+
+			// an event, an interrupt or a write to the code end it early
+			if (m->cpu.clock_count >= c.until || m->cpu.pending || b->gen != m->blocks.gen[b->pc >> 8])
+				break;
+		}
+#else
+		c.opcode = read(&c, c.pc);
+		c.pc++;
+		c.status |= U;
+
+		switch (c.opcode) {
+#define OP(code, name, operate, addrmode, cyc) \
+		case code: \
+			EXEC(code, operate, addrmode, cyc) \
+			break;
+
+			OPCODES
+#undef OP
+		}
+
+		m->cpu.clock_count += c.cycles;
+		c.cycles = 0;
+#endif
+	}
+
+	c.status = getstatus(&c);
+	c.pending = m->cpu.pending & ~SCHEDLINE;
+	c.irq = m->cpu.irq;
+	c.stall = m->cpu.stall;
+	c.stallalign = m->cpu.stallalign;
+	c.clock_count = m->cpu.clock_count;
+	c.until = 0;
+	m->cpu = c;
+
+	return m->cpu.clock_count - start;
+}
+
+#undef EXEC
+
+#endif // NEMU_CORE
+
+
+// with NEMU_LAZYFLAGS, Z and N are not kept in status while running. the
+// handlers only record the byte they derive from (zres, nres) and the
+// flags are worked out when something actually looks at them.
+static uint8_t getflag(struct cpu *cpu, enum FLAGS6502 f)
+{
+#ifdef NEMU_LAZYFLAGS
+	if (f == Z)
+		return cpu->zres == 0;
+	if (f == N)
+		return cpu->nres >> 7;
+#endif
+	return (cpu->status & f) ? 1 : 0;
+}
+
+
+static void setflag(struct cpu *cpu, enum FLAGS6502 f, _Bool v)
+{
+#ifdef NEMU_LAZYFLAGS
+	if (f == Z) {
+		cpu->zres = !v;
+		return;
+	}
+	if (f == N) {
+		cpu->nres = v ? 0x80 : 0x00;
+		return;
+	}
+#endif
+	if (v)
+		cpu->status |= f;
+	else
+		cpu->status &= ~f;
+}
+
+
+// set Z and N from a result
+static inline void setnz(struct cpu *cpu, uint8_t v)
+{
+#ifdef NEMU_LAZYFLAGS
+	cpu->zres = v;
+	cpu->nres = v;
+#else
+	setflag(cpu, Z, v == 0);
+	setflag(cpu, N, v & 0x80);
+#endif
 }
 
 
-uint8_t read(uint16_t addr)
+// status register as the program sees it
+static inline uint8_t getstatus(struct cpu *cpu)
 {
-	return busread(addr, 0);
+#ifdef NEMU_LAZYFLAGS
+	return (cpu->status & ~(Z | N)) | (cpu->zres ? 0 : Z) | (cpu->nres & N);
+#else
+	return cpu->status;
+#endif
 }
 
 
-void write(uint16_t addr, uint8_t data)
+static inline void setstatus(struct cpu *cpu, uint8_t v)
 {
-	buswrite(addr, data);
+	cpu->status = v;
+#ifdef NEMU_LAZYFLAGS
+	cpu->zres = !(v & Z);
+	cpu->nres = v & N;
+#endif
 }
 
 
 // addressing modes
-uint8_t IMP()
+static inline uint8_t IMP(struct cpu *cpu)
 {
-	fetched = cpu.a;
+	cpu->fetched = cpu->a;
 	return 0;
 }
 
 
-uint8_t IMM()
+static inline uint8_t IMM(struct cpu *cpu)
 {
-	addr_abs = cpu.pc++;
+	cpu->addr_abs = cpu->pc++;
 	return 0;
 }
 
 
-uint8_t ZP0()
+static inline uint8_t ZP0(struct cpu *cpu)
 {
-	addr_abs = read(cpu.pc);
-	cpu.pc++;
-	addr_abs &= 0x00FF;
+	cpu->addr_abs = read(cpu, cpu->pc);
+	cpu->pc++;
+	cpu->addr_abs &= 0x00FF;
 	return 0;
 }
 
 
-uint8_t ZPX()
+static inline uint8_t ZPX(struct cpu *cpu)
 {
-	addr_abs = (read(cpu.pc) + cpu.x);
-	cpu.pc++;
-	addr_abs &= 0x00FF;
+	cpu->addr_abs = (read(cpu, cpu->pc) + cpu->x);
+	cpu->pc++;
+	cpu->addr_abs &= 0x00FF;
 	return 0;
 }
 
 
-uint8_t ZPY()
+static inline uint8_t ZPY(struct cpu *cpu)
 {
-	addr_abs = (read(cpu.pc) + cpu.y);
-	cpu.pc++;
-	addr_abs &= 0x00FF;
+	cpu->addr_abs = (read(cpu, cpu->pc) + cpu->y);
+	cpu->pc++;
+	cpu->addr_abs &= 0x00FF;
 	return 0;
 }
 
 
-uint8_t REL()
+static inline uint8_t REL(struct cpu *cpu)
 {
-	addr_rel = read(cpu.pc);
-	cpu.pc++;
-	if (addr_rel & 0x80)
-		addr_rel |= 0xFF00;
+	cpu->addr_rel = read(cpu, cpu->pc);
+	cpu->pc++;
+	if (cpu->addr_rel & 0x80)
+		cpu->addr_rel |= 0xFF00;
 	return 0;
 }
 
 
-uint8_t ABS()
+static inline uint8_t ABS(struct cpu *cpu)
 {
-	uint16_t lo = read(cpu.pc);
-	cpu.pc++;
-	uint16_t hi = read(cpu.pc);
-	cpu.pc++;
+	uint16_t lo = read(cpu, cpu->pc);
+	cpu->pc++;
+	uint16_t hi = read(cpu, cpu->pc);
+	cpu->pc++;
 
-	addr_abs = (hi << 8) | lo;
+	cpu->addr_abs = (hi << 8) | lo;
 	return 0;
 }
 
 
-uint8_t ABX()
+static inline uint8_t ABX(struct cpu *cpu)
 {
-	uint16_t lo = read(cpu.pc);
-	cpu.pc++;
-	uint16_t hi = read(cpu.pc);
-	cpu.pc++;
+	uint16_t lo = read(cpu, cpu->pc);
+	cpu->pc++;
+	uint16_t hi = read(cpu, cpu->pc);
+	cpu->pc++;
 
-	addr_abs = (hi << 8) | lo;
-	addr_abs += cpu.x;
+	cpu->addr_abs = (hi << 8) | lo;
+	cpu->addr_abs += cpu->x;
 
-	if ((addr_abs & 0xFF00) != (hi << 8))
+	if ((cpu->addr_abs & 0xFF00) != (hi << 8))
 		return 1;
 	else
 		return 0;
 }
 
 
-uint8_t ABY()
+static inline uint8_t ABY(struct cpu *cpu)
 {
-	uint16_t lo = read(cpu.pc);
-	cpu.pc++;
-	uint16_t hi = read(cpu.pc);
-	cpu.pc++;
+	uint16_t lo = read(cpu, cpu->pc);
+	cpu->pc++;
+	uint16_t hi = read(cpu, cpu->pc);
+	cpu->pc++;
 
-	addr_abs = (hi << 8) | lo;
-	addr_abs += cpu.y;
+	cpu->addr_abs = (hi << 8) | lo;
+	cpu->addr_abs += cpu->y;
 
-	if ((addr_abs & 0xFF00) != (hi << 8))
+	if ((cpu->addr_abs & 0xFF00) != (hi << 8))
 		return 1;
 	else
 		return 0;
 }
 
 
-uint8_t IND()
+static inline uint8_t IND(struct cpu *cpu)
 {
-	uint16_t ptr_lo = read(cpu.pc);
-	cpu.pc++;
-	uint16_t ptr_hi = read(cpu.pc);
-	cpu.pc++;
+	uint16_t ptr_lo = read(cpu, cpu->pc);
+	cpu->pc++;
+	uint16_t ptr_hi = read(cpu, cpu->pc);
+	cpu->pc++;
 
 	uint16_t ptr = (ptr_hi << 8) | ptr_lo;
 
 	if (ptr_lo == 0x00FF)
-		addr_abs = (read(ptr & 0xFF00) << 8) | read(ptr + 0);
+		cpu->addr_abs = (read(cpu, ptr & 0xFF00) << 8) | read(cpu, ptr + 0);
 	else
-		addr_abs = (read(ptr + 1) << 8) | read(ptr + 0);
+		cpu->addr_abs = (read(cpu, ptr + 1) << 8) | read(cpu, ptr + 0);
 
 	return 0;
 }
 
 
-uint8_t IZX()
+static inline uint8_t IZX(struct cpu *cpu)
 {
-	uint16_t ptr = read(cpu.pc);
-	cpu.pc++;
+	uint16_t ptr = read(cpu, cpu->pc);
+	cpu->pc++;
 
-	uint16_t lo = read((uint16_t)(ptr + (uint16_t)cpu.x) & 0x00FF);
-	uint16_t hi = read((uint16_t)(ptr + (uint16_t)cpu.x + 1) & 0x00FF);
+	uint16_t lo = read(cpu, (uint16_t)(ptr + (uint16_t)cpu->x) & 0x00FF);
+	uint16_t hi = read(cpu, (uint16_t)(ptr + (uint16_t)cpu->x + 1) & 0x00FF);
 
-	addr_abs = (hi << 8) | lo;
+	cpu->addr_abs = (hi << 8) | lo;
 
 	return 0;
 }
 
 
-uint8_t IZY()
+static inline uint8_t IZY(struct cpu *cpu)
 {
-	uint16_t ptr = read(cpu.pc);
-	cpu.pc++;
+	uint16_t ptr = read(cpu, cpu->pc);
+	cpu->pc++;
 
-	uint16_t lo = read(ptr & 0x00FF);
-	uint16_t hi = read((ptr + 1) & 0x00FF);
+	uint16_t lo = read(cpu, ptr & 0x00FF);
+	uint16_t hi = read(cpu, (ptr + 1) & 0x00FF);
 
-	addr_abs = (hi << 8) | lo;
-	addr_abs += cpu.y;
+	cpu->addr_abs = (hi << 8) | lo;
+	cpu->addr_abs += cpu->y;
 
-	if ((addr_abs & 0xFF00) != (hi << 8))
+	if ((cpu->addr_abs & 0xFF00) != (hi << 8))
 		return 1;
 	else
 		return 0;
 }
 
 
-// instructions
-uint8_t fetch()
+#if NEMU_CORE == CORE_BLOCK
+
+// predecoded addressing modes. the operand bytes were read when the block
+// was decoded, only the register dependent part is left for run time.
+static inline uint8_t pIMP(struct cpu *cpu, uint16_t operand)
 {
-	if (!(lookup[opcode].operate == IMM))
-		fetched = read(addr_abs);
-	return fetched;
+	(void)operand;
+	cpu->fetched = cpu->a;
+	return 0;
 }
 
 
-uint8_t ADC()
+static inline uint8_t pIMM(struct cpu *cpu, uint16_t operand)
 {
-	fetch();
+	cpu->addr_abs = operand;
+	return 0;
+}
 
-	temp = (uint16_t)cpu.a + (uint16_t)fetched + (uint16_t)getflag(C);
 
-	setflag(C, temp > 255);
-	setflag(Z, (temp & 0x00FF) == 0);
-	setflag(N, temp & 0x80);
-	setflag(V, (~((uint16_t)cpu.a ^ (uint16_t)fetched) & ((uint16_t)cpu.a ^ temp)) & 0x0080);
+static inline uint8_t pZP0(struct cpu *cpu, uint16_t operand)
+{
+	cpu->addr_abs = operand;
+	return 0;
+}
 
-	cpu.a = temp & 0x00FF;
 
-	return 1;
+static inline uint8_t pZPX(struct cpu *cpu, uint16_t operand)
+{
+	cpu->addr_abs = (operand + cpu->x) & 0x00FF;
+	return 0;
 }
 
 
-uint8_t AND()
+static inline uint8_t pZPY(struct cpu *cpu, uint16_t operand)
 {
-	fetch();
+	cpu->addr_abs = (operand + cpu->y) & 0x00FF;
+	return 0;
+}
 
-	cpu.a &= fetched;
-	setflag(Z, cpu.a == 0x00);
-	setflag(N, cpu.a & 0x80);
 
-	return 1;
+static inline uint8_t pREL(struct cpu *cpu, uint16_t operand)
+{
+	cpu->addr_rel = operand;
+	return 0;
 }
 
 
-uint8_t ASL()
+static inline uint8_t pABS(struct cpu *cpu, uint16_t operand)
 {
-	temp = (uint16_t)cpu.a << 1;
+	cpu->addr_abs = operand;
+	return 0;
+}
 
-	setflag(C, temp > 255);
-	setflag(Z, (temp & 0x00FF) == 0);
-	setflag(N, temp & 0x80);
 
-	if (lookup[opcode].addrmode == IMP)
-		cpu.a = temp & 0x00FF;
+static inline uint8_t pABX(struct cpu *cpu, uint16_t operand)
+{
+	cpu->addr_abs = operand + cpu->x;
+
+	if ((cpu->addr_abs & 0xFF00) != (operand & 0xFF00))
+		return 1;
 	else
-		write(addr_abs, temp & 0x00FF);
+		return 0;
+}
+
+
+static inline uint8_t pABY(struct cpu *cpu, uint16_t operand)
+{
+	cpu->addr_abs = operand + cpu->y;
+
+	if ((cpu->addr_abs & 0xFF00) != (operand & 0xFF00))
+		return 1;
+	else
+		return 0;
+}
+
+
+static inline uint8_t pIND(struct cpu *cpu, uint16_t operand)
+{
+	uint16_t ptr = operand;
+
+	if ((ptr & 0x00FF) == 0x00FF)
+		cpu->addr_abs = (read(cpu, ptr & 0xFF00) << 8) | read(cpu, ptr + 0);
+	else
+		cpu->addr_abs = (read(cpu, ptr + 1) << 8) | read(cpu, ptr + 0);
+
+	return 0;
+}
+
+
+static inline uint8_t pIZX(struct cpu *cpu, uint16_t operand)
+{
+	uint16_t lo = read(cpu, (uint16_t)(operand + (uint16_t)cpu->x) & 0x00FF);
+	uint16_t hi = read(cpu, (uint16_t)(operand + (uint16_t)cpu->x + 1) & 0x00FF);
+
+	cpu->addr_abs = (hi << 8) | lo;
 
 	return 0;
 }
 
 
-uint8_t BCC()
+static inline uint8_t pIZY(struct cpu *cpu, uint16_t operand)
 {
-	if (getflag(C) == 0) {
-		cycles++;
-		addr_abs = cpu.pc + addr_rel;
+	uint16_t lo = read(cpu, operand & 0x00FF);
+	uint16_t hi = read(cpu, (operand + 1) & 0x00FF);
 
-		if ((cpu.pc & 0xFF00) != (addr_abs & 0xFF00))
-			cycles++;
+	cpu->addr_abs = (hi << 8) | lo;
+	cpu->addr_abs += cpu->y;
 
-		cpu.pc = addr_abs;
+	if ((cpu->addr_abs & 0xFF00) != (hi << 8))
+		return 1;
+	else
+		return 0;
+}
+
+
+// decode up to max instructions starting at pc into b. stops after the
+// first instruction that can leave the straight line and before one that
+// would cross into the next page.
+static void blockdecode(struct nemu_machine *m, struct block *b, uint16_t pc, int max)
+{
+	b->pc = pc;
+	b->n = 0;
+
+	while (b->n < max) {
+		uint8_t opcode = busread(m, pc, 0);
+		const struct instruction *in = &lookup[opcode];
+		struct blockop *op = &b->op[b->n];
+		uint8_t len = cpulen(opcode);
+
+		// blockfind() only caches blocks whose first instruction fits
+		if (b->n && (pc & 0xFF) + len > 0x100)
+			break;
+
+		op->opcode = opcode;
+		op->len = len;
+
+		if (in->addrmode == IMM) {
+			op->operand = pc + 1;
+		} else if (in->addrmode == REL) {
+			op->operand = busread(m, pc + 1, 0);
+			if (op->operand & 0x80)
+				op->operand |= 0xFF00;
+		} else if (len == 2) {
+			op->operand = busread(m, pc + 1, 0);
+		} else if (len == 3) {
+			op->operand = busread(m, pc + 1, 0) | (busread(m, pc + 2, 0) << 8);
+		}
+
+		b->n++;
+		pc += len;
+
+		if (in->addrmode == REL || in->operate == JMP || in->operate == JSR ||
+				in->operate == RTS || in->operate == RTI || in->operate == BRK)
+			break;
+		if ((pc & 0xFF) == 0)
+			break;
+	}
+}
+
+
+// cached block starting at pc, or a one instruction block decoded into tmp
+// when pc can't be cached
+static const struct block *blockfind(struct nemu_machine *m, uint16_t pc, _Bool uncached, struct block *tmp)
+{
+	struct blockcache *bc = &m->blocks;
+	struct block *b = &bc->slot[pc & (BLOCKSLOTS - 1)];
+	uint8_t page = pc >> 8;
+
+	if (b->n && b->pc == pc && b->gen == bc->gen[page])
+		return b;
+
+	if (!uncached && m->bus.page[page].rd && (pc & 0xFF) <= 0xFD) {
+		blockdecode(m, b, pc, BLOCKMAX);
+		b->gen = bc->gen[page];
+		buswatch(m, page, WATCHCODE);
+		return b;
+	}
+
+	blockdecode(m, tmp, pc, 1);
+	tmp->gen = bc->gen[page];
+	return tmp;
+}
+
+#endif // CORE_BLOCK
+
+
+// idle loops. a short loop that only reads memory and ends up with the
+// registers it started with, say lda flag / beq back, will go round the
+// same way until an interrupt or a device changes something, and neither
+// can happen before the run stops for its budget or the next scheduled
+// event. when a backward jump lands on the same target with the same
+// registers and exactly the loop body ran in between, the iterations that
+// fit before that stop are skipped in one go. the cycles and instructions
+// they would have taken are counted, so the run ends in the same state as
+// one that spun.
+#define IDLEBYTES 16    // longest loop looked at
+#define IDLEOPS   8
+
+enum IDLEKIND {
+	IDLEUNKNOWN,
+	IDLENEVER,      // writes, calls, talks to a device or is too long
+	IDLEMAYBE,      // idle if the registers don't change going round
+};
+
+// the loop from start up to end only reads memory and is straight line
+// code except for the jump at its end. returns its length in instructions,
+// 0 if it is not like that.
+static int idlebody(struct cpu *cpu, uint16_t start, uint16_t end)
+{
+	struct nemu_machine *m = cpu->m;
+	int n = 0;
+
+	for (uint16_t pc = start; pc != end; n++) {
+		const uint8_t *rd = m->bus.page[pc >> 8].rd;
+		uint8_t opcode = rd ? rd[pc & 0xFF] : 0x00;
+		const struct instruction *in = &lookup[opcode];
+		uint8_t len = cpulen(opcode);
+
+		if (!rd || n == IDLEOPS || (uint16_t)(end - pc) < len)
+			return 0;
+
+		// the jump back, nothing after it
+		if ((uint16_t)(end - pc) == len)
+			return in->addrmode == REL || opcode == 0x4C ? n + 1 : 0;
+
+		if (!(in->operate == LDA || in->operate == LDX || in->operate == LDY || in->operate == BIT ||
+		      in->operate == CMP || in->operate == CPX || in->operate == CPY || in->operate == AND ||
+		      in->operate == ORA || in->operate == EOR || in->operate == ADC || in->operate == SBC ||
+		      in->operate == NOP || in->operate == TAX || in->operate == TAY || in->operate == TXA ||
+		      in->operate == TYA || in->operate == INX || in->operate == INY || in->operate == DEX ||
+		      in->operate == DEY || in->operate == CLC || in->operate == SEC || in->operate == CLV ||
+		      ((in->operate == ASL || in->operate == LSR || in->operate == ROL || in->operate == ROR) &&
+		       in->addrmode == IMP)))
+			return 0;
+
+		// operands must be fixed addresses of plain memory, a device
+		// could change what a read returns or do something on reading,
+		// unless it says it won't before the next event
+		if (in->addrmode == ZP0 || in->addrmode == ABS) {
+			uint16_t addr = rd[(pc + 1) & 0xFF];
+
+			if (in->addrmode == ABS) {
+				const uint8_t *hi = m->bus.page[(uint16_t)(pc + 2) >> 8].rd;
+
+				if (((pc + 1) & 0xFF) == 0xFF || !hi)
+					return 0;
+				addr |= hi[(pc + 2) & 0xFF] << 8;
+			}
+
+			const struct buspage *p = &m->bus.page[addr >> 8];
+
+			if (!p->rd && !(p->dev && p->dev->steady && p->dev->steady(m, p->base | (addr & p->mask))))
+				return 0;
+		} else if (in->addrmode != IMP && in->addrmode != IMM) {
+			return 0;
+		}
+
+		pc += len;
 	}
 
 	return 0;
 }
 
 
-uint8_t BCS()
+// the registers matched on two jumps back to the same target in a row.
+// the first time note when, the next time skip if it went exactly once
+// round the loop in between.
+static void idleskip(struct cpu *cpu, uint16_t target)
 {
-	if (getflag(C) == 1) {
-		cycles++;
-		addr_abs = cpu.pc + addr_rel;
+	struct nemu_machine *m = cpu->m;
+	uint64_t now = m->cpu.clock_count;
+
+	// traced and profiled runs have to see every time round
+	if (cpu->idleclock < now && now < m->cpu.until && !cpu->nbreak && !m->trace && !m->profile) {
+		uint64_t iter = now - cpu->idleclock;
+		uint64_t ins = cpu->instructions - cpu->idleins;
 
-		if ((cpu.pc & 0xFF00) != (addr_abs & 0xFF00))
-			cycles++;
+		if (ins <= IDLEOPS && idlebody(cpu, target, cpu->pc) == (int)ins) {
+			uint64_t n = (m->cpu.until - now - 1) / iter;
 
-		cpu.pc = addr_abs;
+			now += n * iter;
+			m->cpu.clock_count = now;
+			cpu->instructions += n * ins;
+		}
 	}
 
-	return 0;
+	cpu->idleclock = now;
+	cpu->idleins = cpu->instructions;
 }
 
 
-uint8_t BEQ()
+// first sight of the jump ending at cpu->pc, remember whether its loop
+// could ever be idle so most jumps only cost a look in m->idle
+static uint8_t idlelook(struct cpu *cpu, uint16_t target)
 {
-	if (getflag(Z) == 1) {
-		cycles++;
-		addr_abs = cpu.pc + addr_rel;
+	struct nemu_machine *m = cpu->m;
+	uint16_t at = cpu->pc;
+	uint8_t kind = idlebody(cpu, target, at) ? IDLEMAYBE : IDLENEVER;
 
-		if ((cpu.pc & 0xFF00) != (addr_abs & 0xFF00))
-			cycles++;
+	m->idle[at >> 2] |= kind << ((at & 3) * 2);
+	return kind;
+}
 
-		cpu.pc = addr_abs;
+
+// called on a jump to target from the instruction ending at cpu->pc,
+// before its cycles are counted
+static inline void idle(struct cpu *cpu, uint16_t target)
+{
+	uint16_t at = cpu->pc;
+	uint8_t kind = (cpu->m->idle[at >> 2] >> ((at & 3) * 2)) & 3;
+
+	if (kind == IDLENEVER || (kind == IDLEUNKNOWN && idlelook(cpu, target) == IDLENEVER))
+		return;
+
+	uint64_t regs = cpu->a | cpu->x << 8 | cpu->y << 16 | (uint64_t)cpu->stkp << 24 |
+	                (uint64_t)getstatus(cpu) << 32 | (uint64_t)target << 40;
+
+	if (regs == cpu->idleregs) {
+		idleskip(cpu, target);
+	} else {
+		cpu->idleregs = regs;
+		cpu->idleclock = UINT64_MAX;
 	}
+}
 
-	return 0;
+
+// a taken branch costs a cycle, and another if it crosses a page
+static inline void branch(struct cpu *cpu)
+{
+	cpu->cycles++;
+	cpu->addr_abs = cpu->pc + cpu->addr_rel;
+
+	if ((cpu->pc & 0xFF00) != (cpu->addr_abs & 0xFF00))
+		cpu->cycles++;
+
+	if ((uint16_t)(cpu->pc - cpu->addr_abs) <= IDLEBYTES)
+		idle(cpu, cpu->addr_abs);
+
+	cpu->pc = cpu->addr_abs;
 }
 
 
-uint8_t BIT()
+// instructions
+static uint8_t fetch(struct cpu *cpu)
 {
-	fetch();
+	if (!(lookup[cpu->opcode].addrmode == IMP))
+		cpu->fetched = read(cpu, cpu->addr_abs);
+	return cpu->fetched;
+}
 
-	setflag(Z, (cpu.a & fetched) == 0);
-	setflag(N, fetched & 0x80);
-	setflag(V, fetched & 0x40);
 
-	return 0;
+static inline uint8_t ADC(struct cpu *cpu)
+{
+	fetch(cpu);
+
+	cpu->temp = (uint16_t)cpu->a + (uint16_t)cpu->fetched + (uint16_t)getflag(cpu, C);
+
+	setflag(cpu, C, cpu->temp > 255);
+	setnz(cpu, cpu->temp & 0x00FF);
+	setflag(cpu, V, (~((uint16_t)cpu->a ^ (uint16_t)cpu->fetched) & ((uint16_t)cpu->a ^ cpu->temp)) & 0x0080);
+
+	cpu->a = cpu->temp & 0x00FF;
+
+	return 1;
+}
+
+
+static inline uint8_t AND(struct cpu *cpu)
+{
+	fetch(cpu);
+
+	cpu->a &= cpu->fetched;
+	setnz(cpu, cpu->a);
+
+	return 1;
 }
 
 
-uint8_t BMI()
+static inline uint8_t ASL(struct cpu *cpu)
 {
-	if (getflag(N) == 1) {
-		cycles++;
-		addr_abs = cpu.pc + addr_rel;
+	fetch(cpu);
+
+	cpu->temp = (uint16_t)cpu->fetched << 1;
+
+	setflag(cpu, C, cpu->temp > 255);
+	setnz(cpu, cpu->temp & 0x00FF);
+
+	if (lookup[cpu->opcode].addrmode == IMP)
+		cpu->a = cpu->temp & 0x00FF;
+	else
+		write(cpu, cpu->addr_abs, cpu->temp & 0x00FF);
+
+	return 0;
+}
 
-		if ((cpu.pc & 0xFF00) != (addr_abs & 0xFF00))
-			cycles++;
 
-		cpu.pc = addr_abs;
+static inline uint8_t BCC(struct cpu *cpu)
+{
+	if (getflag(cpu, C) == 0) {
+		branch(cpu);
 	}
 
 	return 0;
 }
 
 
-uint8_t BNE()
+static inline uint8_t BCS(struct cpu *cpu)
 {
-	if (getflag(Z) == 0) {
-		cycles++;
-		addr_abs = cpu.pc + addr_rel;
+	if (getflag(cpu, C) == 1) {
+		branch(cpu);
+	}
+
+	return 0;
+}
 
-		if ((cpu.pc & 0xFF00) != (addr_abs & 0xFF00))
-			cycles++;
 
-		cpu.pc = addr_abs;
+static inline uint8_t BEQ(struct cpu *cpu)
+{
+	if (getflag(cpu, Z) == 1) {
+		branch(cpu);
 	}
 
 	return 0;
 }
 
 
-uint8_t BPL()
+static inline uint8_t BIT(struct cpu *cpu)
 {
-	if (getflag(N) == 0) {
-		cycles++;
-		addr_abs = cpu.pc + addr_rel;
+	fetch(cpu);
+
+	setflag(cpu, Z, (cpu->a & cpu->fetched) == 0);
+	setflag(cpu, N, cpu->fetched & 0x80);
+	setflag(cpu, V, cpu->fetched & 0x40);
+
+	return 0;
+}
 
-		if ((cpu.pc & 0xFF00) != (addr_abs & 0xFF00))
-			cycles++;
 
-		cpu.pc = addr_abs;
+static inline uint8_t BMI(struct cpu *cpu)
+{
+	if (getflag(cpu, N) == 1) {
+		branch(cpu);
 	}
 
 	return 0;
 }
 
 
-uint8_t BRK()
+static inline uint8_t BNE(struct cpu *cpu)
 {
-	cpu.pc++;
+	if (getflag(cpu, Z) == 0) {
+		branch(cpu);
+	}
 
-	write(cpu.stkp, (cpu.pc >> 8) & 0x00FF);
-	cpu.stkp--;
-	write(cpu.stkp, cpu.pc & 0x00FF);
-	cpu.stkp--;
+	return 0;
+}
 
-	setflag(I, 1);
-	setflag(B, 1);
-	write(cpu.stkp, cpu.status);
-	cpu.stkp--;
 
-	cpu.pc = (uint16_t)read(0xFFFE) | ((uint16_t)read(0xFFFF) << 8);
+static inline uint8_t BPL(struct cpu *cpu)
+{
+	if (getflag(cpu, N) == 0) {
+		branch(cpu);
+	}
 
 	return 0;
 }
 
 
-uint8_t BVC()
+static inline uint8_t BRK(struct cpu *cpu)
 {
-	if (getflag(V) == 0) {
-		cycles++;
-		addr_abs = cpu.pc + addr_rel;
+	// IMM already stepped over the padding byte
+	write(cpu, 0x0100 + cpu->stkp, (cpu->pc >> 8) & 0x00FF);
+	cpu->stkp--;
+	write(cpu, 0x0100 + cpu->stkp, cpu->pc & 0x00FF);
+	cpu->stkp--;
 
-		if ((cpu.pc & 0xFF00) != (addr_abs & 0xFF00))
-			cycles++;
+	write(cpu, 0x0100 + cpu->stkp, getstatus(cpu) | B | U);
+	cpu->stkp--;
+	setflag(cpu, I, 1);
 
-		cpu.pc = addr_abs;
-	}
+	cpu->pc = (uint16_t)read(cpu, 0xFFFE) | ((uint16_t)read(cpu, 0xFFFF) << 8);
 
 	return 0;
 }
 
 
-uint8_t BVS()
+static inline uint8_t BVC(struct cpu *cpu)
 {
-	if (getflag(V) == 1) {
-		cycles++;
-		addr_abs = cpu.pc + addr_rel;
+	if (getflag(cpu, V) == 0) {
+		branch(cpu);
+	}
+
+	return 0;
+}
 
-		if ((cpu.pc & 0xFF00) != (addr_abs & 0xFF00))
-			cycles++;
 
-		cpu.pc = addr_abs;
+static inline uint8_t BVS(struct cpu *cpu)
+{
+	if (getflag(cpu, V) == 1) {
+		branch(cpu);
 	}
 
 	return 0;
 }
 
 
-uint8_t CLC()
+static inline uint8_t CLC(struct cpu *cpu)
 {
-	setflag(C, 0);
+	setflag(cpu, C, 0);
 
 	return 0;
 }
 
 
-uint8_t CLD()
+static inline uint8_t CLD(struct cpu *cpu)
 {
-	setflag(D, 0);
+	setflag(cpu, D, 0);
 
 	return 0;
 }
 
 
-uint8_t CLI()
+static inline uint8_t CLI(struct cpu *cpu)
 {
-	setflag(I, 0);
+	setflag(cpu, I, 0);
 
 	return 0;
 }
 
 
-uint8_t CLV()
+static inline uint8_t CLV(struct cpu *cpu)
 {
-	setflag(V, 0);
+	setflag(cpu, V, 0);
 
 	return 0;
 }
 
 
-uint8_t CMP()
+static inline uint8_t CMP(struct cpu *cpu)
 {
-	fetch();
+	fetch(cpu);
 
-	temp = (uint16_t)cpu.a - (uint16_t)fetched;
-	setflag(C, cpu.a >= fetched);
-	setflag(Z, cpu.a == fetched);
-	setflag(N, (temp & 0x00FF) & 0x80);
+	cpu->temp = (uint16_t)cpu->a - (uint16_t)cpu->fetched;
+	setflag(cpu, C, cpu->a >= cpu->fetched);
+	setnz(cpu, cpu->temp & 0x00FF);
 
 	return 1;
 }
 
 
-uint8_t CPX()
+static inline uint8_t CPX(struct cpu *cpu)
 {
-	fetch();
+	fetch(cpu);
 
-	temp = (uint16_t)cpu.x - (uint16_t)fetched;
-	setflag(C, cpu.x >= fetched);
-	setflag(Z, cpu.x == fetched);
-	setflag(N, (temp & 0x00FF) & 0x80);
+	cpu->temp = (uint16_t)cpu->x - (uint16_t)cpu->fetched;
+	setflag(cpu, C, cpu->x >= cpu->fetched);
+	setnz(cpu, cpu->temp & 0x00FF);
 
 	return 0;
 }
 
 
-uint8_t CPY()
+static inline uint8_t CPY(struct cpu *cpu)
 {
-	fetch();
+	fetch(cpu);
 
-	temp = (uint16_t)cpu.y - (uint16_t)fetched;
-	setflag(C, cpu.y >= fetched);
-	setflag(Z, cpu.y == fetched);
-	setflag(N, (temp & 0x00FF) & 0x80);
+	cpu->temp = (uint16_t)cpu->y - (uint16_t)cpu->fetched;
+	setflag(cpu, C, cpu->y >= cpu->fetched);
+	setnz(cpu, cpu->temp & 0x00FF);
 
 	return 0;
 }
 
 
-uint8_t DEC()
+static inline uint8_t DEC(struct cpu *cpu)
 {
-	fetch();
+	fetch(cpu);
 
-	temp = fetched - 1;
+	cpu->temp = cpu->fetched - 1;
 
-	write(addr_abs, temp & 0x00FF);
+	write(cpu, cpu->addr_abs, cpu->temp & 0x00FF);
 
-	setflag(Z, (temp & 0x00FF) == 0);
-	setflag(N, temp & 0x0080);
+	setnz(cpu, cpu->temp & 0x00FF);
 
 	return 0;
 }
 
 
-uint8_t DEX()
+static inline uint8_t DEX(struct cpu *cpu)
 {
-	cpu.x--;
+	cpu->x--;
 
-	setflag(Z, cpu.x == 0);
-	setflag(N, cpu.x & 0x80);
+	setnz(cpu, cpu->x);
 
 	return 0;
 }
 
 
-uint8_t DEY()
+static inline uint8_t DEY(struct cpu *cpu)
 {
-	cpu.y--;
+	cpu->y--;
 
-	setflag(Z, cpu.y == 0);
-	setflag(N, cpu.y & 0x80);
+	setnz(cpu, cpu->y);
 
 	return 0;
 }
 
 
-uint8_t EOR()
+static inline uint8_t EOR(struct cpu *cpu)
 {
-	fetch();
+	fetch(cpu);
 
-	cpu.a ^= fetched;
+	cpu->a ^= cpu->fetched;
 
-	setflag(Z, cpu.a == 0);
-	setflag(N, cpu.a & 0x80);
+	setnz(cpu, cpu->a);
 
 	return 1;
 }
 
 
-uint8_t INC()
+static inline uint8_t INC(struct cpu *cpu)
 {
-	fetch();
+	fetch(cpu);
 
-	temp = fetched + 1;
+	cpu->temp = cpu->fetched + 1;
 
-	write(addr_abs, temp & 0x00FF);
+	write(cpu, cpu->addr_abs, cpu->temp & 0x00FF);
 
-	setflag(Z, (temp & 0x00FF) == 0);
-	setflag(N, temp & 0x0080);
+	setnz(cpu, cpu->temp & 0x00FF);
 
 	return 0;
 }
 
 
-uint8_t INX()
+static inline uint8_t INX(struct cpu *cpu)
 {
-	cpu.x++;
+	cpu->x++;
 
-	setflag(Z, cpu.x == 0);
-	setflag(N, cpu.x & 0x80);
+	setnz(cpu, cpu->x);
 
 	return 0;
 }
 
 
-uint8_t INY()
+static inline uint8_t INY(struct cpu *cpu)
 {
-	cpu.y++;
+	cpu->y++;
 
-	setflag(Z, cpu.y == 0);
-	setflag(N, cpu.y & 0x80);
+	setnz(cpu, cpu->y);
 
 	return 0;
 }
 
 
-uint8_t JMP()
+static inline uint8_t JMP(struct cpu *cpu)
 {
-	cpu.pc = addr_abs;
+	if (cpu->opcode == 0x4C && (uint16_t)(cpu->pc - cpu->addr_abs) <= IDLEBYTES)
+		idle(cpu, cpu->addr_abs);
+
+	cpu->pc = cpu->addr_abs;
 
 	return 0;
 }
 
 
-uint8_t JSR()
+static inline uint8_t JSR(struct cpu *cpu)
 {
-	cpu.pc--;
+	cpu->pc--;
 
-	write(0x0100 + cpu.stkp, (cpu.pc >> 8) & 0x00FF);
-	cpu.stkp--;
-	write(0x0100 + cpu.stkp, cpu.pc & 0x00FF);
-	cpu.stkp--;
+	write(cpu, 0x0100 + cpu->stkp, (cpu->pc >> 8) & 0x00FF);
+	cpu->stkp--;
+	write(cpu, 0x0100 + cpu->stkp, cpu->pc & 0x00FF);
+	cpu->stkp--;
 
-	cpu.pc = addr_abs;
+	cpu->pc = cpu->addr_abs;
 
 	return 0;
 }
 
 
-uint8_t LDA()
+static inline uint8_t LDA(struct cpu *cpu)
 {
-	fetch();
+	fetch(cpu);
 
-	cpu.a = fetched;
+	cpu->a = cpu->fetched;
 
-	setflag(Z, cpu.a == 0);
-	setflag(N, cpu.a & 0x80);
+	setnz(cpu, cpu->a);
 
 	return 1;
 }
 
 
-uint8_t LDX()
+static inline uint8_t LDX(struct cpu *cpu)
 {
-	fetch();
+	fetch(cpu);
 
-	cpu.x = fetched;
+	cpu->x = cpu->fetched;
 
-	setflag(Z, cpu.x == 0);
-	setflag(N, cpu.x & 0x80);
+	setnz(cpu, cpu->x);
 
 	return 1;
 }
 
 
-uint8_t LDY()
+static inline uint8_t LDY(struct cpu *cpu)
 {
-	fetch();
+	fetch(cpu);
 
-	cpu.y = fetched;
+	cpu->y = cpu->fetched;
 
-	setflag(Z, cpu.y == 0);
-	setflag(N, cpu.y & 0x80);
+	setnz(cpu, cpu->y);
 
 	return 1;
 }
 
 
-uint8_t LSR()
+static inline uint8_t LSR(struct cpu *cpu)
 {
-	fetch();
+	fetch(cpu);
 
-	if (lookup[opcode].addrmode == IMP) {
-		temp = (uint16_t)cpu.a >> 1;
-		setflag(C, cpu.a & 0x01);
+	if (lookup[cpu->opcode].addrmode == IMP) {
+		cpu->temp = (uint16_t)cpu->a >> 1;
+		setflag(cpu, C, cpu->a & 0x01);
 	} else {
-		temp = (uint16_t)fetched >> 1;
-		setflag(C, fetched & 0x01);
+		cpu->temp = (uint16_t)cpu->fetched >> 1;
+		setflag(cpu, C, cpu->fetched & 0x01);
 	}
 
-	setflag(Z, (temp & 0x00FF) == 0);
-	setflag(N, temp & 0x80);
+	setnz(cpu, cpu->temp & 0x00FF);
 
-	if (lookup[opcode].addrmode == IMP)
-		cpu.a = temp & 0x00FF;
+	if (lookup[cpu->opcode].addrmode == IMP)
+		cpu->a = cpu->temp & 0x00FF;
 	else
-		write(addr_abs, temp & 0x00FF);
+		write(cpu, cpu->addr_abs, cpu->temp & 0x00FF);
 
 	return 0;
 }
 
 
-uint8_t NOP()
+static inline uint8_t NOP(struct cpu *cpu)
 {
-	switch (opcode) {
+	switch (cpu->opcode) {
 		case 0x1C:
 		case 0x3C:
 		case 0x5C:
@@ -792,255 +1568,252 @@ uint8_t NOP()
 }
 
 
-uint8_t ORA()
+static inline uint8_t ORA(struct cpu *cpu)
 {
-	fetch();
+	fetch(cpu);
 
-	cpu.a |= fetched;
+	cpu->a |= cpu->fetched;
 
-	setflag(Z, cpu.a == 0);
-	setflag(N, cpu.a & 0x80);
+	setnz(cpu, cpu->a);
 
 	return 1;
 }
 
 
-uint8_t PHA()
+static inline uint8_t PHA(struct cpu *cpu)
 {
-	write(0x0100 + cpu.stkp, cpu.a);
-	cpu.stkp--;
+	write(cpu, 0x0100 + cpu->stkp, cpu->a);
+	cpu->stkp--;
 
 	return 0;
 }
 
 
-uint8_t PHP()
+static inline uint8_t PHP(struct cpu *cpu)
 {
-	setflag(U, 1);
-	setflag(B, 1);
+	setflag(cpu, U, 1);
+	setflag(cpu, B, 1);
 
-	write(0x0100 + cpu.stkp, cpu.status);
-	cpu.stkp--;
+	write(cpu, 0x0100 + cpu->stkp, getstatus(cpu));
+	cpu->stkp--;
 
-	setflag(U, 0);
-	setflag(B, 0);
+	setflag(cpu, U, 0);
+	setflag(cpu, B, 0);
 
 	return 0;
 }
 
 
-uint8_t PLA()
+static inline uint8_t PLA(struct cpu *cpu)
 {
-	cpu.stkp++;
-	cpu.a = read(0x0100 + cpu.stkp);
+	cpu->stkp++;
+	cpu->a = read(cpu, 0x0100 + cpu->stkp);
 
-	setflag(Z, cpu.a == 0);
-	setflag(N, cpu.a & 0x80);
+	setnz(cpu, cpu->a);
 
 	return 0;
 }
 
 
-uint8_t PLP()
+static inline uint8_t PLP(struct cpu *cpu)
 {
-	cpu.stkp++;
-	cpu.status = read(0x0100 + cpu.stkp);
+	cpu->stkp++;
+	setstatus(cpu, read(cpu, 0x0100 + cpu->stkp));
 
 	return 0;
 }
 
 
-uint8_t ROL()
+static inline uint8_t ROL(struct cpu *cpu)
 {
-	fetch();
+	fetch(cpu);
 
-	temp = (uint16_t)fetched << 1 | getflag(C);
-	cpu.a = temp & 0x00FF;
+	cpu->temp = (uint16_t)cpu->fetched << 1 | getflag(cpu, C);
 
-	setflag(C, temp & 0x0100);
-	setflag(Z, (temp & 0x00FF) == 0);
-	setflag(N, temp & 0x0080);
+	setflag(cpu, C, cpu->temp & 0x0100);
+	setnz(cpu, cpu->temp & 0x00FF);
 
-	if (lookup[opcode].addrmode == IMP)
-		cpu.a = temp & 0x00FF;
+	if (lookup[cpu->opcode].addrmode == IMP)
+		cpu->a = cpu->temp & 0x00FF;
 	else
-		write(addr_abs, temp & 0x00FF);
+		write(cpu, cpu->addr_abs, cpu->temp & 0x00FF);
 
 	return 0;
 }
 
 
-uint8_t ROR()
+static inline uint8_t ROR(struct cpu *cpu)
 {
-	fetch();
+	fetch(cpu);
 
-	temp = (uint16_t)fetched >> 1 | getflag(C) << 7;
-	cpu.a = temp & 0x00FF;
+	cpu->temp = (uint16_t)cpu->fetched >> 1 | getflag(cpu, C) << 7;
 
-	setflag(C, fetched & 0x01);
-	setflag(Z, (temp & 0x00FF) == 0);
-	setflag(N, temp & 0x0080);
+	setflag(cpu, C, cpu->fetched & 0x01);
+	setnz(cpu, cpu->temp & 0x00FF);
 
-	if (lookup[opcode].addrmode == IMP)
-		cpu.a = temp & 0x00FF;
+	if (lookup[cpu->opcode].addrmode == IMP)
+		cpu->a = cpu->temp & 0x00FF;
 	else
-		write(addr_abs, temp & 0x00FF);
+		write(cpu, cpu->addr_abs, cpu->temp & 0x00FF);
 
 	return 0;
 }
 
 
-uint8_t RTI()
+static inline uint8_t RTI(struct cpu *cpu)
 {
-	cpu.stkp++;
-	cpu.status = read(0x0100 + cpu.stkp);
-	setflag(B, 0);
-	setflag(U, 0);
-	cpu.stkp++;
-	cpu.pc = read(0x0100 + cpu.stkp) | read(0x0100 + cpu.stkp + 1) << 8;
-	cpu.stkp++;
+	cpu->stkp++;
+	setstatus(cpu, read(cpu, 0x0100 + cpu->stkp));
+	setflag(cpu, B, 0);
+	setflag(cpu, U, 0);
+	cpu->stkp++;
+	cpu->pc = read(cpu, 0x0100 + cpu->stkp);
+	cpu->stkp++;
+	cpu->pc |= read(cpu, 0x0100 + cpu->stkp) << 8;
 
 	return 0;
 }
 
 
-uint8_t RTS()
+static inline uint8_t RTS(struct cpu *cpu)
 {
-	cpu.stkp++;
-	cpu.pc = read(0x0100 + cpu.stkp) | read(0x0100 + cpu.stkp + 1) << 8;
-	cpu.stkp++;
+	cpu->stkp++;
+	cpu->pc = read(cpu, 0x0100 + cpu->stkp);
+	cpu->stkp++;
+	cpu->pc |= read(cpu, 0x0100 + cpu->stkp) << 8;
 
-	cpu.pc++;
+	cpu->pc++;
 
 	return 0;
 }
 
 
-uint8_t SBC()
+static inline uint8_t SBC(struct cpu *cpu)
 {
-	fetch();
+	fetch(cpu);
 
-	uint16_t invval = ((uint16_t)fetched) ^ 0x00FF;
+	uint16_t invval = ((uint16_t)cpu->fetched) ^ 0x00FF;
 
-	temp = (uint16_t)cpu.a + invval + (uint16_t)getflag(C);
+	cpu->temp = (uint16_t)cpu->a + invval + (uint16_t)getflag(cpu, C);
 
-	setflag(C, temp > 255);
-	setflag(Z, (temp & 0x00FF) == 0);
-	setflag(N, temp & 0x80);
-	setflag(V, (temp ^ invval) & ((uint16_t)cpu.a ^ temp) & 0x0080);
+	setflag(cpu, C, cpu->temp > 255);
+	setnz(cpu, cpu->temp & 0x00FF);
+	setflag(cpu, V, (cpu->temp ^ invval) & ((uint16_t)cpu->a ^ cpu->temp) & 0x0080);
 
-	cpu.a = temp & 0x00FF;
+	cpu->a = cpu->temp & 0x00FF;
 
 	return 1;
 }
 
 
-uint8_t SEC()
+static inline uint8_t SEC(struct cpu *cpu)
 {
-	setflag(C, 1);
+	setflag(cpu, C, 1);
 
 	return 0;
 }
 
 
-uint8_t SED()
+static inline uint8_t SED(struct cpu *cpu)
 {
-	setflag(D, 1);
+	setflag(cpu, D, 1);
 
 	return 0;
 }
 
 
-uint8_t SEI()
+static inline uint8_t SEI(struct cpu *cpu)
 {
-	setflag(I, 1);
+	setflag(cpu, I, 1);
 
 	return 0;
 }
 
 
-uint8_t STA()
+static inline uint8_t STA(struct cpu *cpu)
 {
-	write(addr_abs, cpu.a);
+	write(cpu, cpu->addr_abs, cpu->a);
 
 	return 0;
 }
 
 
-uint8_t STX()
+static inline uint8_t STX(struct cpu *cpu)
 {
-	write(addr_abs, cpu.x);
+	write(cpu, cpu->addr_abs, cpu->x);
 
 	return 0;
 }
 
 
-uint8_t STY()
+static inline uint8_t STY(struct cpu *cpu)
 {
-	write(addr_abs, cpu.y);
+	write(cpu, cpu->addr_abs, cpu->y);
 
 	return 0;
 }
 
 
-uint8_t TAX()
+static inline uint8_t TAX(struct cpu *cpu)
 {
-	cpu.x = cpu.a;
+	cpu->x = cpu->a;
 
-	setflag(Z, cpu.x == 0);
-	setflag(N, cpu.x & 0x80);
+	setnz(cpu, cpu->x);
 
 	return 0;
 }
 
 
-uint8_t TAY()
+static inline uint8_t TAY(struct cpu *cpu)
 {
-	cpu.y = cpu.a;
+	cpu->y = cpu->a;
 
-	setflag(Z, cpu.y == 0);
-	setflag(N, cpu.y & 0x80);
+	setnz(cpu, cpu->y);
 
 	return 0;
 }
 
 
-uint8_t TSX()
+static inline uint8_t TSX(struct cpu *cpu)
 {
-	cpu.x = cpu.stkp;
+	cpu->x = cpu->stkp;
 
-	setflag(Z, cpu.x == 0);
-	setflag(N, cpu.x & 0x80);
+	setnz(cpu, cpu->x);
 
 	return 0;
 }
 
 
-uint8_t TXA()
+static inline uint8_t TXA(struct cpu *cpu)
 {
-	cpu.a = cpu.x;
+	cpu->a = cpu->x;
 
-	setflag(Z, cpu.a == 0);
-	setflag(N, cpu.a & 0x80);
+	setnz(cpu, cpu->a);
 
 	return 0;
 }
 
 
-uint8_t TXS()
+static inline uint8_t TXS(struct cpu *cpu)
 {
-	cpu.stkp = cpu.x;
+	cpu->stkp = cpu->x;
 
 	return 0;
 }
 
 
-uint8_t TYA()
+static inline uint8_t TYA(struct cpu *cpu)
 {
-	cpu.a = cpu.y;
+	cpu->a = cpu->y;
+
+	setnz(cpu, cpu->a);
 
-	setflag(Z, cpu.a == 0);
-	setflag(N, cpu.a & 0x80);
+	return 0;
+}
 
+
+static inline uint8_t XXX(struct cpu *cpu)
+{
+	(void)cpu;
 	return 0;
 }
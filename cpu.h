@@ -3,17 +3,57 @@
 
 #include <stdint.h>
 
-#include "bus.h"
+// interpreter cores, pick one at build time with -DNEMU_CORE=...
+#define CORE_TABLE    1    // reference core dispatching through lookup[]
+#define CORE_SWITCH   2    // addressing mode and operation fused per opcode
+#define CORE_THREADED 3    // CORE_SWITCH with computed goto dispatch (gcc, clang)
+#define CORE_BLOCK    4    // CORE_SWITCH over a cache of predecoded basic blocks
 
+#ifndef NEMU_CORE
+#if defined(__GNUC__)
+#define NEMU_CORE CORE_THREADED
+#else
+#define NEMU_CORE CORE_SWITCH
+#endif
+#endif
 
-static struct {
+struct nemu_machine;
+
+struct cpu {
 	uint8_t a;         // accumulator
 	uint8_t x;         // x register
 	uint8_t y;         // y register
 	uint8_t stkp;      // stack pointer
 	uint16_t pc;       // program counter
 	uint8_t status;    // status register
-} cpu;
+	uint8_t zres;      // Z and N source bytes while running with NEMU_LAZYFLAGS
+	uint8_t nres;
+
+	// internal state of the instruction in flight
+	uint8_t fetched;
+	uint16_t temp;
+	uint16_t addr_abs;
+	uint16_t addr_rel;
+	uint8_t opcode;
+	uint16_t cycles;          // a dma stall under cputick() can pass 255
+	uint64_t clock_count;
+	uint64_t instructions;    // instructions retired
+
+	uint8_t pending;      // interrupt lines waiting for an instruction boundary
+	uint8_t irq;          // sources holding the irq line, see cpuirqline()
+	uint16_t stall;       // cycles a dma takes the bus for at the next one, see cpustall()
+	uint8_t stallalign;   // and it starts on an even cycle
+	uint8_t stop;         // why the last cpurun() returned
+	uint16_t nbreak;      // breakpoints set in the machine's bitmap
+	uint64_t until;       // clock_count cpurun() stops at next, 0 outside a run
+
+	// the last short backward jump, for spotting idle loops
+	uint64_t idleregs;    // target, p, s, y, x and a
+	uint64_t idleclock;
+	uint64_t idleins;
+
+	struct nemu_machine *m;    // machine owning the bus we run on
+};
 
 enum FLAGS6502 {
 	C = (1 << 0),    // carry bit
@@ -26,10 +66,57 @@ enum FLAGS6502 {
 	N = (1 << 7),    // negative
 };
 
+enum CPULINES {
+	IRQLINE = (1 << 0),
+	NMILINE = (1 << 1),
+	HALTLINE = (1 << 2),    // not a real line, stops cpurun() from a device
+	SCHEDLINE = (1 << 3),   // not a real line, an event was scheduled before cpu.until
+	STALLLINE = (1 << 4),   // not a real line, a dma wants the bus
+};
+
+// the irq line is level triggered: it stays asserted while any source
+// holds it, and a device lets go when the program acknowledges it
+enum IRQSOURCE {
+	IRQEXTERNAL = (1 << 0),    // cpuirq(), dropped once taken
+	IRQFRAME = (1 << 1),       // the apu's frame counter
+	IRQDMC = (1 << 2),         // the apu's dmc reaching the end of a sample
+	IRQMAPPER = (1 << 3),      // the cart, mmc3's scanline counter say
+};
+
+enum CPUSTOP {
+	CPU_BUDGET,      // ran through the cycle budget
+	CPU_IRQ,         // took an interrupt
+	CPU_NMI,         // took a nonmaskable interrupt
+	CPU_BREAK,       // reached a breakpoint, pc points at it
+	CPU_HALT,        // cpuhalt() was called
+};
+
+
+// the decode table, indexed by opcode
+struct instruction {
+	char *name;
+	uint8_t (*operate)(struct cpu *);
+	uint8_t (*addrmode)(struct cpu *);
+	uint8_t cycles;
+	char *mode;        // name of the addressing mode, for tools
+};
+
+extern const struct instruction lookup[256];
+
+
+void cpureset(struct nemu_machine *m);    // reset the cpu to a known state
+void cpuirq(struct nemu_machine *m);      // request an interrupt at the next instruction boundary
+void cpuirqline(struct nemu_machine *m, uint8_t source, _Bool held);    // a device asserts or releases irq
+void cpunmi(struct nemu_machine *m);      // request a nonmaskable interrupt
+void cpuhalt(struct nemu_machine *m);     // stop cpurun() at the next instruction boundary
+void cpustall(struct nemu_machine *m, uint16_t cycles, _Bool align);    // a dma holds the cpu after this instruction
+void cpubreak(struct nemu_machine *m, uint16_t addr, _Bool on);    // set or clear a breakpoint
+void cputick(struct nemu_machine *m);     // perform one clock cycle
+uint8_t cpulen(uint8_t opcode);           // instruction length in bytes
 
-void cpureset();    // reset the cpu to a known state
-void cpuirq();      // perform an interrupt
-void cpunmi();      // perform a nonmaskable interrupt
-void cputick();     // perform one clock cycle
+// run whole instructions until at least budget cycles have passed or an
+// interrupt or breakpoint stops it (see cpu.stop), firing scheduled events
+// as their time comes. returns the cycles used.
+uint32_t cpurun(struct nemu_machine *m, uint32_t budget);
 
 #endif // CPU_H_
@@ -0,0 +1,321 @@
+// test rom farm: runs many images through batchrun() on a pool of worker
+// threads, one machine per worker, and writes a csv or json report.
+//
+//   farm [-j jobs] [-f csv|json] [batch options] dir|manifest ...
+//
+// a directory contributes every regular file in it, a manifest one path
+// per line. blank lines and lines starting with # are skipped. a path can
+// be followed by a tab and an input log to play back, recorded with nemu -R.
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "machine.h"
+
+struct job {
+	char *path;
+	char *movie;                // input log to replay, or NULL
+	int status;                 // batchstatus(), 3 if it didn't load
+	int error;                  // errno from batchload()
+	struct batchresult r;
+	double wall;                // seconds
+};
+
+struct farm {
+	struct batchopts opts;
+	struct job *jobs;
+	size_t njobs;
+	size_t cap;
+	size_t next;                // first job nobody has picked up
+	pthread_mutex_t lock;
+};
+
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: farm [-j jobs] [-f csv|json] [-a loadaddr] [-e entry] [-p pc] [-w addr] [-c cycles] [-n] [-s state] [-m seed] dir|manifest ...\n\n%s", batchhelp);
+	exit(3);
+}
+
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static void addjob(struct farm *f, const char *path, const char *movie)
+{
+	if (f->njobs == f->cap) {
+		f->cap = f->cap ? f->cap * 2 : 64;
+		f->jobs = realloc(f->jobs, f->cap * sizeof(*f->jobs));
+		if (!f->jobs) {
+			perror("farm");
+			exit(3);
+		}
+	}
+
+	// a job no worker got to fails
+	f->jobs[f->njobs++] = (struct job){ .path = strdup(path), .movie = movie ? strdup(movie) : NULL,
+	                                    .status = 3, .error = ECANCELED };
+}
+
+
+static int bypath(const void *a, const void *b)
+{
+	return strcmp(((const struct job *)a)->path, ((const struct job *)b)->path);
+}
+
+
+static void adddir(struct farm *f, const char *dir)
+{
+	DIR *d = opendir(dir);
+	struct dirent *e;
+	struct stat st;
+	char path[4096];
+	size_t first = f->njobs;
+
+	if (!d) {
+		perror(dir);
+		exit(3);
+	}
+
+	while ((e = readdir(d))) {
+		snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+		if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+			addjob(f, path, NULL);
+	}
+	closedir(d);
+
+	// readdir order is arbitrary, keep reports comparable between runs
+	qsort(f->jobs + first, f->njobs - first, sizeof(*f->jobs), bypath);
+}
+
+
+static void addmanifest(struct farm *f, const char *manifest)
+{
+	FILE *fp = fopen(manifest, "r");
+	char line[4096];
+
+	if (!fp) {
+		perror(manifest);
+		exit(3);
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (!line[0] || line[0] == '#')
+			continue;
+
+		char *tab = strchr(line, '\t');
+
+		if (tab)
+			*tab++ = '\0';
+		addjob(f, line, tab);
+	}
+	fclose(fp);
+}
+
+
+static void *worker(void *arg)
+{
+	struct farm *f = arg;
+	struct nemu_machine *m = nemu_new();
+
+	if (!m)
+		return NULL;
+
+	for (;;) {
+		pthread_mutex_lock(&f->lock);
+		size_t i = f->next < f->njobs ? f->next++ : f->njobs;
+		pthread_mutex_unlock(&f->lock);
+
+		if (i == f->njobs)
+			break;
+
+		struct job *j = &f->jobs[i];
+		struct inputlog log = { 0 };
+		double t = now();
+
+		nemu_init(m);
+		if (batchload(m, j->path, &f->opts) < 0) {
+			j->error = errno;
+		} else if (j->movie && (inputlogload(&log, j->movie) < 0 || inputreplay(m, &log) < 0)) {
+			j->error = errno;
+		} else {
+			j->error = 0;
+			batchrun(m, &f->opts, &j->r);
+			j->status = batchstatus(&f->opts, &j->r);
+		}
+		inputlogfree(&log);
+		cartclose(&m->cart);
+		j->wall = now() - t;
+	}
+
+	nemu_free(m);
+	return NULL;
+}
+
+
+static void jsonstring(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+
+// quoted, csv readers choke on commas in file names
+static void csvstring(const char *s)
+{
+	putchar('"');
+	for (; *s; s++)
+		printf(*s == '"' ? "\"\"" : "%c", *s);
+	putchar('"');
+}
+
+
+static void reportcsv(const struct farm *f)
+{
+	printf("path,input,result,status,stop,value,cycles,instructions,wall\n");
+	for (size_t i = 0; i < f->njobs; i++) {
+		const struct job *j = &f->jobs[i];
+
+		csvstring(j->path);
+		putchar(',');
+		csvstring(j->movie ? j->movie : "");
+		printf(",%s,%d,%s,%d,%llu,%llu,%.6f\n",
+		       j->status ? "fail" : "pass", j->status,
+		       j->error ? "error" : batchstopname[j->r.stop], j->r.value,
+		       (unsigned long long)j->r.cycles, (unsigned long long)j->r.instructions,
+		       j->wall);
+	}
+}
+
+
+static void reportjson(const struct farm *f, double wall)
+{
+	size_t passed = 0;
+
+	printf("{\n  \"results\": [\n");
+	for (size_t i = 0; i < f->njobs; i++) {
+		const struct job *j = &f->jobs[i];
+
+		passed += j->status == 0;
+		printf("    {\"path\": ");
+		jsonstring(j->path);
+		if (j->movie) {
+			printf(", \"input\": ");
+			jsonstring(j->movie);
+		}
+		printf(", \"result\": \"%s\", \"status\": %d, ", j->status ? "fail" : "pass", j->status);
+		if (j->error) {
+			printf("\"error\": ");
+			jsonstring(strerror(j->error));
+		} else {
+			printf("\"stop\": \"%s\", \"value\": %d, \"cycles\": %llu, \"instructions\": %llu",
+			       batchstopname[j->r.stop], j->r.value,
+			       (unsigned long long)j->r.cycles, (unsigned long long)j->r.instructions);
+		}
+		printf(", \"wall\": %.6f}%s\n", j->wall, i + 1 < f->njobs ? "," : "");
+	}
+	printf("  ],\n  \"passed\": %zu,\n  \"failed\": %zu,\n  \"wall\": %.6f\n}\n",
+	       passed, f->njobs - passed, wall);
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct farm f = { .lock = PTHREAD_MUTEX_INITIALIZER };
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	_Bool json = 0;
+	struct stat st;
+	int opt;
+
+	batchdefaults(&f.opts);
+
+	while ((opt = getopt(argc, argv, "j:f:" BATCHOPTS)) != -1) {
+		switch (opt) {
+		case 'j':
+			jobs = atol(optarg);
+			break;
+		case 'f':
+			if (strcmp(optarg, "json") == 0)
+				json = 1;
+			else if (strcmp(optarg, "csv") == 0)
+				json = 0;
+			else
+				usage();
+			break;
+		default:
+			if (batchopt(&f.opts, opt, optarg) < 0)
+				usage();
+		}
+	}
+	if (optind == argc || jobs < 1)
+		usage();
+
+	for (int i = optind; i < argc; i++) {
+		if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+			adddir(&f, argv[i]);
+		else
+			addmanifest(&f, argv[i]);
+	}
+
+	if ((size_t)jobs > f.njobs)
+		jobs = f.njobs ? f.njobs : 1;
+
+	pthread_t *threads = malloc(jobs * sizeof(*threads));
+	double t = now();
+
+	if (!threads) {
+		perror("farm");
+		return 3;
+	}
+
+	for (long i = 0; i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, worker, &f) != 0) {
+			perror("farm");
+			return 3;
+		}
+	}
+	for (long i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+
+	t = now() - t;
+
+	if (json)
+		reportjson(&f, t);
+	else
+		reportcsv(&f);
+
+	int failed = 0;
+
+	for (size_t i = 0; i < f.njobs; i++) {
+		failed |= f.jobs[i].status != 0;
+		free(f.jobs[i].path);
+		free(f.jobs[i].movie);
+	}
+	free(f.jobs);
+	free(threads);
+
+	return failed;
+}
@@ -0,0 +1,247 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machine.h"
+
+#define LOGVERSION 1
+#define EVENTSIZE  11    // clock, type, port, data on disk
+
+
+// reads shift the buttons out a for first, then ones like an official pad.
+// while the strobe is high they keep reloading and only a is seen.
+uint8_t inputread(struct nemu_machine *m, uint16_t addr)
+{
+	struct pads *p = &m->pads;
+	int port = addr & 1;
+
+	if (p->strobe)
+		p->shift[port] = p->buttons[port];
+
+	uint8_t bit = p->shift[port] & 1;
+
+	p->shift[port] = (p->shift[port] >> 1) | 0x80;
+	return 0x40 | bit;    // the upper bits are open bus, usually $40
+}
+
+
+void inputwrite(struct nemu_machine *m, uint16_t addr, uint8_t data)
+{
+	struct pads *p = &m->pads;
+
+	if (addr != 0x4016)
+		return;
+
+	p->strobe = data & 1;
+	if (p->strobe) {
+		p->shift[0] = p->buttons[0];
+		p->shift[1] = p->buttons[1];
+	}
+}
+
+static const struct devonbus padbus = { 0x4016, 0x4017, inputwrite, inputread, NULL };
+
+
+void inputinit(struct nemu_machine *m)
+{
+	memset(&m->pads, 0, sizeof(m->pads));
+	busmapio(m, &padbus);
+}
+
+
+static void record(struct nemu_machine *m, uint8_t type, uint8_t port, uint8_t data)
+{
+	struct inputlog *l = m->log;
+
+	if (!l || l->mode != INPUTRECORD)
+		return;
+
+	if (l->n == l->cap) {
+		size_t cap = l->cap ? l->cap * 2 : 256;
+		struct inputevent *ev = realloc(l->ev, cap * sizeof(*ev));
+
+		// a log that can't grow would replay wrong, better to abort
+		if (!ev) {
+			perror("input log");
+			abort();
+		}
+		l->ev = ev;
+		l->cap = cap;
+	}
+
+	l->ev[l->n++] = (struct inputevent){ m->cpu.clock_count, type, port, data };
+}
+
+
+void inputpad(struct nemu_machine *m, uint8_t port, uint8_t buttons)
+{
+	record(m, EVENTPAD, port, buttons);
+	m->pads.buttons[port & 1] = buttons;
+}
+
+
+void inputirq(struct nemu_machine *m)
+{
+	record(m, EVENTIRQ, 0, 0);
+	cpuirq(m);
+}
+
+
+void inputnmi(struct nemu_machine *m)
+{
+	record(m, EVENTNMI, 0, 0);
+	cpunmi(m);
+}
+
+
+void inputrecord(struct nemu_machine *m, struct inputlog *l)
+{
+	memset(l, 0, sizeof(*l));
+	l->mode = INPUTRECORD;
+	l->start = m->cpu.clock_count;
+	m->log = l;
+	schedat(m, SCHEDINPUT, UINT64_MAX);
+}
+
+
+int inputreplay(struct nemu_machine *m, struct inputlog *l)
+{
+	if (m->cpu.clock_count != l->start) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	l->mode = INPUTREPLAY;
+	l->next = 0;
+	m->log = l;
+	schedat(m, SCHEDINPUT, inputdue(m));
+	return 0;
+}
+
+
+uint64_t inputdue(struct nemu_machine *m)
+{
+	const struct inputlog *l = m->log;
+
+	if (!l || l->mode != INPUTREPLAY || l->next == l->n)
+		return UINT64_MAX;
+
+	return l->ev[l->next].clock;
+}
+
+
+// the recording was made between cpurun() calls, on an instruction
+// boundary, and the scheduler calls this on the same one
+void inputfeed(struct nemu_machine *m)
+{
+	struct inputlog *l = m->log;
+
+	while (inputdue(m) <= m->cpu.clock_count) {
+		const struct inputevent *e = &l->ev[l->next++];
+
+		switch (e->type) {
+		case EVENTPAD: m->pads.buttons[e->port & 1] = e->data; break;
+		case EVENTIRQ: cpuirq(m); break;
+		case EVENTNMI: cpunmi(m); break;
+		}
+	}
+
+	schedat(m, SCHEDINPUT, inputdue(m));
+}
+
+
+void inputlogfree(struct inputlog *l)
+{
+	free(l->ev);
+	l->ev = NULL;
+	l->n = l->cap = l->next = 0;
+}
+
+
+static void le(uint8_t *p, uint64_t v, int n)
+{
+	for (int i = 0; i < n; i++)
+		p[i] = v >> (8 * i);
+}
+
+static uint64_t unle(const uint8_t *p, int n)
+{
+	uint64_t v = 0;
+
+	for (int i = n - 1; i >= 0; i--)
+		v = v << 8 | p[i];
+	return v;
+}
+
+
+// "NEMUINP", a version, the start clock and the event count, then the
+// events, all little endian
+int inputlogsave(const struct inputlog *l, const char *path)
+{
+	FILE *f = fopen(path, "wb");
+	uint8_t hdr[8 + 2 + 8 + 4];
+	uint8_t e[EVENTSIZE];
+
+	if (!f)
+		return -1;
+
+	memcpy(hdr, "NEMUINP", 8);
+	le(hdr + 8, LOGVERSION, 2);
+	le(hdr + 10, l->start, 8);
+	le(hdr + 18, l->n, 4);
+	fwrite(hdr, 1, sizeof(hdr), f);
+
+	for (size_t i = 0; i < l->n; i++) {
+		le(e, l->ev[i].clock, 8);
+		e[8] = l->ev[i].type;
+		e[9] = l->ev[i].port;
+		e[10] = l->ev[i].data;
+		fwrite(e, 1, sizeof(e), f);
+	}
+
+	if (ferror(f)) {
+		fclose(f);
+		return -1;
+	}
+	return fclose(f) == 0 ? 0 : -1;
+}
+
+
+int inputlogload(struct inputlog *l, const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	uint8_t hdr[8 + 2 + 8 + 4];
+	uint8_t e[EVENTSIZE];
+
+	memset(l, 0, sizeof(*l));
+
+	if (!f)
+		return -1;
+
+	if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr) || memcmp(hdr, "NEMUINP", 8) != 0 ||
+	    unle(hdr + 8, 2) != LOGVERSION)
+		goto bad;
+
+	l->start = unle(hdr + 10, 8);
+	l->cap = l->n = unle(hdr + 18, 4);
+	if (l->n && !(l->ev = malloc(l->n * sizeof(*l->ev)))) {
+		fclose(f);
+		return -1;
+	}
+
+	for (size_t i = 0; i < l->n; i++) {
+		if (fread(e, 1, sizeof(e), f) != sizeof(e))
+			goto bad;
+		l->ev[i] = (struct inputevent){ unle(e, 8), e[8], e[9], e[10] };
+	}
+
+	fclose(f);
+	return 0;
+
+bad:
+	fclose(f);
+	inputlogfree(l);
+	errno = EINVAL;
+	return -1;
+}
@@ -0,0 +1,74 @@
+#ifndef INPUT_H_
+#define INPUT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// nes controllers at $4016/$4017 and the input log. everything from the
+// outside that can change a run, button states and injected interrupts,
+// goes through inputpad(), inputirq() and inputnmi(). with a log attached
+// they are recorded against clock_count, and a replaying log feeds them
+// back at the same cycles, so a run can be reproduced bit for bit.
+
+enum PADBUTTON {
+	PADA      = (1 << 0),
+	PADB      = (1 << 1),
+	PADSELECT = (1 << 2),
+	PADSTART  = (1 << 3),
+	PADUP     = (1 << 4),
+	PADDOWN   = (1 << 5),
+	PADLEFT   = (1 << 6),
+	PADRIGHT  = (1 << 7),
+};
+
+struct pads {
+	uint8_t buttons[2];    // what is held down
+	uint8_t shift[2];      // what the cpu reads out next, a bit at a time
+	uint8_t strobe;
+};
+
+enum INPUTEVENT {
+	EVENTPAD,
+	EVENTIRQ,
+	EVENTNMI,
+};
+
+struct inputevent {
+	uint64_t clock;
+	uint8_t type;     // INPUTEVENT
+	uint8_t port;
+	uint8_t data;
+};
+
+enum INPUTMODE {
+	INPUTRECORD = 1,
+	INPUTREPLAY,
+};
+
+struct inputlog {
+	uint8_t mode;            // INPUTMODE
+	uint64_t start;          // clock_count the log begins at
+	struct inputevent *ev;
+	size_t n;
+	size_t cap;
+	size_t next;             // next event to replay
+};
+
+struct nemu_machine;
+
+void inputinit(struct nemu_machine *m);    // put the controllers on the bus
+uint8_t inputread(struct nemu_machine *m, uint16_t addr);     // $4016/$4017, for the apu that shares the page
+void inputwrite(struct nemu_machine *m, uint16_t addr, uint8_t data);
+void inputpad(struct nemu_machine *m, uint8_t port, uint8_t buttons);
+void inputirq(struct nemu_machine *m);
+void inputnmi(struct nemu_machine *m);
+
+void inputrecord(struct nemu_machine *m, struct inputlog *l);    // start an empty log here
+int inputreplay(struct nemu_machine *m, struct inputlog *l);     // feed l back, -1 unless m is where it started
+uint64_t inputdue(struct nemu_machine *m);     // clock of the next event to replay, UINT64_MAX if none
+void inputfeed(struct nemu_machine *m);        // replay the events that are due, the scheduler calls it
+void inputlogfree(struct inputlog *l);         // free the events, not l
+int inputlogload(struct inputlog *l, const char *path);    // 0 or -1 with errno set
+int inputlogsave(const struct inputlog *l, const char *path);
+
+#endif // INPUT_H_
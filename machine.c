@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "machine.h"
+
+
+void nemu_init(struct nemu_machine *m)
+{
+	memset(&m->cpu, 0, sizeof(m->cpu));
+	m->cpu.m = m;
+	memset(m->breakpoints, 0, sizeof(m->breakpoints));
+	memset(m->idle, 0, sizeof(m->idle));
+	m->shared = NULL;
+	m->cart.file = NULL;
+	m->cart.users = NULL;
+	schedinit(&m->sched);
+	memset(&m->ppu, 0, sizeof(m->ppu));
+	m->screen = NULL;
+	m->pitch = 0;
+	memset(&m->apu, 0, sizeof(m->apu));
+	m->apulogn = 0;
+	m->audio = NULL;
+	memset(&m->pads, 0, sizeof(m->pads));
+	m->log = NULL;
+	m->trace = NULL;
+	m->profile = NULL;
+
+	businit(m);
+	raminit(m);
+}
+
+
+struct nemu_machine *nemu_new()
+{
+	struct nemu_machine *m = malloc(sizeof(*m));
+
+	if (m)
+		nemu_init(m);
+
+	return m;
+}
+
+
+void nemu_free(struct nemu_machine *m)
+{
+	if (m) {
+		cartclose(&m->cart);
+		ramrelease(m);
+	}
+	free(m);
+}
+
+
+// between runs, and m changes as well: its ram is frozen into pages both
+// read until they write them. a fork starts with the same state and gets
+// nothing of the caller's: no screen, audio, input log, trace or profile.
+struct nemu_machine *nemu_fork(struct nemu_machine *m)
+{
+	struct nemu_machine *f = malloc(sizeof(*f));
+
+	if (!f)
+		return NULL;
+	if (cartdup(&f->cart, &m->cart) < 0) {
+		free(f);
+		return NULL;
+	}
+	if (ramfreeze(m) < 0) {
+		cartclose(&f->cart);
+		free(f);
+		return NULL;
+	}
+
+	f->cpu = m->cpu;
+	f->cpu.m = f;
+
+	// after the freeze only mem still points at ram
+	f->bus = m->bus;
+	for (int i = 0; i < BUSPAGES; i++) {
+		uint8_t *mem = m->bus.page[i].mem;
+
+		if (mem >= m->ram && mem < m->ram + RAMSIZE)
+			f->bus.page[i].mem = f->ram + (mem - m->ram);
+	}
+	ramshare(f, m);
+
+	memcpy(f->breakpoints, m->breakpoints, sizeof(f->breakpoints));
+	memcpy(f->idle, m->idle, sizeof(f->idle));
+	f->sched = m->sched;
+	f->ppu = m->ppu;
+	memcpy(f->vram, m->vram, sizeof(f->vram));
+	memcpy(f->oam, m->oam, sizeof(f->oam));
+	f->screen = NULL;
+	f->pitch = 0;
+	f->apu = m->apu;
+	memcpy(f->apulog, m->apulog, m->apulogn * sizeof(f->apulog[0]));
+	f->apulogn = m->apulogn;
+	f->audio = NULL;
+	f->pads = m->pads;
+	f->log = NULL;
+	f->trace = NULL;
+	f->profile = NULL;
+#if NEMU_CORE == CORE_BLOCK
+	f->blocks = m->blocks;
+#endif
+
+	return f;
+}
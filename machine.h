@@ -0,0 +1,87 @@
+#ifndef MACHINE_H_
+#define MACHINE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "apu.h"
+#include "block.h"
+#include "bus.h"
+#include "cart.h"
+#include "cpu.h"
+#include "input.h"
+#include "ppu.h"
+#include "profile.h"
+#include "ram.h"
+#include "sched.h"
+#include "trace.h"
+
+// everything one emulated machine owns. there is no global state, so any
+// number of machines can run side by side in one process.
+struct nemu_machine {
+	struct cpu cpu;
+	struct bus bus;
+	uint8_t ram[RAMSIZE];
+	struct ramset *shared;               // ram frozen by nemu_fork(), or NULL
+	uint8_t owned[RAMPAGES / 8];         // pages of it ram[] has back
+	uint8_t breakpoints[0x10000 / 8];    // one bit per address, see cpubreak()
+	uint8_t idle[0x10000 / 4];           // two bits per jump back, see idle() in cpu.c
+	struct cart cart;                    // inserted by the caller after nemu_init()
+	struct sched sched;
+	struct ppu ppu;                      // set up by ppuinit(), raw images have none
+	uint8_t vram[PPUVRAM];
+	uint8_t oam[256];
+	uint8_t *screen;                     // see nemu_set_screen(), or NULL
+	size_t pitch;
+	struct apu apu;                      // set up by apuinit(), raw images have none
+	struct apuwrite apulog[APULOG];      // register writes the batch has yet to play
+	uint16_t apulogn;
+	struct audio *audio;                 // where apusync() puts samples, or NULL
+	struct pads pads;
+	struct inputlog *log;                // recording or replaying input, or NULL
+	struct trace *trace;                 // where NEMU_TRACE builds log instructions, or NULL
+	struct profile *profile;             // where NEMU_PROFILE builds count them, or NULL
+#if NEMU_CORE == CORE_BLOCK
+	struct blockcache blocks;
+#endif
+};
+
+
+// code cached from page may be stale
+static inline void blockinvalidate(struct nemu_machine *m, uint8_t page)
+{
+#if NEMU_CORE == CORE_BLOCK
+	m->blocks.gen[page]++;
+#endif
+	memset(m->idle + page * (BUSPAGESIZE / 4), 0, BUSPAGESIZE / 4);
+}
+
+
+void nemu_init(struct nemu_machine *m);        // power on with the default memory map, no cart
+struct nemu_machine *nemu_new();               // allocate and init a machine
+void nemu_free(struct nemu_machine *m);        // also closes the cart
+struct nemu_machine *nemu_fork(struct nemu_machine *m);    // a copy sharing ram and rom until written, NULL without memory
+
+
+static inline uint8_t busread(struct nemu_machine *m, uint16_t addr, _Bool readonly)
+{
+	const struct buspage *p = &m->bus.page[addr >> 8];
+
+	if (p->rd)
+		return p->rd[addr & 0xFF];
+
+	return busreadio(m, addr, readonly);
+}
+
+
+static inline void buswrite(struct nemu_machine *m, uint16_t addr, uint8_t data)
+{
+	const struct buspage *p = &m->bus.page[addr >> 8];
+
+	if (p->wr)
+		p->wr[addr & 0xFF] = data;
+	else
+		buswriteio(m, addr, data);
+}
+
+#endif // MACHINE_H_
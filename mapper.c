@@ -0,0 +1,265 @@
+#include <stddef.h>
+
+#include "machine.h"
+#include "mapper.h"
+
+
+// a write can switch chr or mirroring, the ppu has to be caught up to
+// draw what came before it with the old ones
+static void cartwrite(struct nemu_machine *m, uint16_t addr, uint8_t data)
+{
+	if (m->ppu.on)
+		ppusync(m);
+	m->cart.hw->write(m, addr, data);
+}
+
+static const struct devonbus cartbus = { 0x8000, 0xFFFF, cartwrite, NULL, NULL };
+
+
+// map prg bank number bank, counted in size byte units, at addr. negative
+// banks count from the end of the rom, bank numbers wrap like the missing
+// address lines on a real board. parse() keeps prgsize a non-zero
+// multiple of 8K, so chunk is never less than a bus page.
+static void prgmap(struct nemu_machine *m, uint16_t addr, size_t size, int bank)
+{
+	const struct cart *c = &m->cart;
+	size_t chunk = size < c->prgsize ? size : c->prgsize;
+	size_t n = c->prgsize / chunk;
+	size_t per = size / chunk;
+	size_t b;
+
+	if (bank < 0)
+		b = (n - (size_t)-bank * per % n) % n;
+	else
+		b = (size_t)bank * per % n;
+
+	// a rom smaller than the window is mirrored through it
+	for (size_t off = 0; off < size; off += chunk)
+		busmaprom(m, addr + off, addr + off + chunk - 1, c->prg + b * chunk, &cartbus);
+}
+
+
+// same for the 1K chr windows the ppu fetches through
+static void chrmap(struct nemu_machine *m, int window, size_t size, unsigned bank)
+{
+	struct cart *c = &m->cart;
+	const uint8_t *chr = c->chr ? c->chr : c->chrram;
+	size_t total = c->chr ? c->chrsize : CARTCHRRAM;
+
+	for (size_t k = 0; k < size / 0x400; k++)
+		c->chrbank[window + k] = chr + (bank * size + k * 0x400) % total;
+}
+
+
+// nrom: no registers, 16K mirrored or 32K
+static void nrombanks(struct nemu_machine *m)
+{
+	prgmap(m, 0x8000, 0x4000, 0);
+	prgmap(m, 0xC000, 0x4000, -1);
+	chrmap(m, 0, 0x2000, 0);
+}
+
+static void nromwrite(struct nemu_machine *m, uint16_t addr, uint8_t data)
+{
+	(void)m;
+	(void)addr;
+	(void)data;
+}
+
+
+// uxrom: switchable 16K at $8000, last 16K fixed at $C000
+static void uxrombanks(struct nemu_machine *m)
+{
+	prgmap(m, 0x8000, 0x4000, m->cart.regs.reg[0]);
+	prgmap(m, 0xC000, 0x4000, -1);
+	chrmap(m, 0, 0x2000, 0);
+}
+
+static void uxromwrite(struct nemu_machine *m, uint16_t addr, uint8_t data)
+{
+	(void)addr;
+	m->cart.regs.reg[0] = data;
+	prgmap(m, 0x8000, 0x4000, data);
+}
+
+
+// cnrom: fixed prg, switchable 8K chr
+static void cnrombanks(struct nemu_machine *m)
+{
+	prgmap(m, 0x8000, 0x4000, 0);
+	prgmap(m, 0xC000, 0x4000, -1);
+	chrmap(m, 0, 0x2000, m->cart.regs.reg[0]);
+}
+
+static void cnromwrite(struct nemu_machine *m, uint16_t addr, uint8_t data)
+{
+	(void)addr;
+	m->cart.regs.reg[0] = data;
+	chrmap(m, 0, 0x2000, data);
+}
+
+
+// mmc1: registers are loaded a bit at a time through a serial port
+static void mmc1banks(struct nemu_machine *m)
+{
+	struct mapperregs *r = &m->cart.regs;
+	uint8_t prg = r->reg[2] & 0x0F;
+
+	switch ((r->control >> 2) & 0x03) {
+	case 0:
+	case 1:
+		prgmap(m, 0x8000, 0x8000, prg >> 1);
+		break;
+	case 2:
+		prgmap(m, 0x8000, 0x4000, 0);
+		prgmap(m, 0xC000, 0x4000, prg);
+		break;
+	case 3:
+		prgmap(m, 0x8000, 0x4000, prg);
+		prgmap(m, 0xC000, 0x4000, -1);
+		break;
+	}
+
+	if (r->control & 0x10) {
+		chrmap(m, 0, 0x1000, r->reg[0]);
+		chrmap(m, 4, 0x1000, r->reg[1]);
+	} else {
+		chrmap(m, 0, 0x2000, r->reg[0] >> 1);
+	}
+
+	static const uint8_t mirror[] = { MIRRORSINGLELO, MIRRORSINGLEHI, MIRRORVERTICAL, MIRRORHORIZONTAL };
+	m->cart.mirror = mirror[r->control & 0x03];
+}
+
+static void mmc1init(struct nemu_machine *m)
+{
+	m->cart.regs.control = 0x0C;
+}
+
+static void mmc1write(struct nemu_machine *m, uint16_t addr, uint8_t data)
+{
+	struct mapperregs *r = &m->cart.regs;
+
+	if (data & 0x80) {
+		r->shift = 0;
+		r->nshift = 0;
+		r->control |= 0x0C;
+		mmc1banks(m);
+		return;
+	}
+
+	r->shift |= (data & 0x01) << r->nshift;
+	if (++r->nshift < 5)
+		return;
+
+	// fifth write: $8000 control, $A000 chr 0, $C000 chr 1, $E000 prg
+	if (addr < 0xA000)
+		r->control = r->shift;
+	else
+		r->reg[(addr >> 13) - 5] = r->shift;
+
+	r->shift = 0;
+	r->nshift = 0;
+	mmc1banks(m);
+}
+
+
+// mmc3: eight bank registers behind a select port, and a scanline counter
+// clocked by the ppu
+static void mmc3banks(struct nemu_machine *m)
+{
+	struct mapperregs *r = &m->cart.regs;
+	int inv = (r->select & 0x80) ? 4 : 0;
+
+	if (r->select & 0x40) {
+		prgmap(m, 0x8000, 0x2000, -2);
+		prgmap(m, 0xC000, 0x2000, r->reg[6]);
+	} else {
+		prgmap(m, 0x8000, 0x2000, r->reg[6]);
+		prgmap(m, 0xC000, 0x2000, -2);
+	}
+	prgmap(m, 0xA000, 0x2000, r->reg[7]);
+	prgmap(m, 0xE000, 0x2000, -1);
+
+	// two 2K and four 1K windows, the halves swap with chr inversion
+	chrmap(m, 0 ^ inv, 0x800, r->reg[0] >> 1);
+	chrmap(m, 2 ^ inv, 0x800, r->reg[1] >> 1);
+	for (int i = 0; i < 4; i++)
+		chrmap(m, (4 + i) ^ inv, 0x400, r->reg[2 + i]);
+}
+
+static void mmc3init(struct nemu_machine *m)
+{
+	m->cart.regs.reg[7] = 1;
+}
+
+static void mmc3write(struct nemu_machine *m, uint16_t addr, uint8_t data)
+{
+	struct mapperregs *r = &m->cart.regs;
+
+	switch (addr & 0xE001) {
+	case 0x8000:
+		r->select = data;
+		mmc3banks(m);
+		break;
+	case 0x8001:
+		r->reg[r->select & 0x07] = data;
+		mmc3banks(m);
+		break;
+	case 0xA000:
+		if (m->cart.mirror != MIRRORFOUR)
+			m->cart.mirror = (data & 0x01) ? MIRRORHORIZONTAL : MIRRORVERTICAL;
+		break;
+	case 0xA001:
+		break;    // prg ram protect, ram is always on
+	case 0xC000:
+		r->irqlatch = data;
+		break;
+	case 0xC001:
+		r->irqcounter = 0;
+		r->irqreload = 1;
+		break;
+	case 0xE000:
+		r->irqenable = 0;
+		cpuirqline(m, IRQMAPPER, 0);    // and acknowledges
+		break;
+	case 0xE001:
+		r->irqenable = 1;
+		break;
+	}
+}
+
+static void mmc3scanline(struct nemu_machine *m)
+{
+	struct mapperregs *r = &m->cart.regs;
+
+	if (r->irqcounter == 0 || r->irqreload) {
+		r->irqcounter = r->irqlatch;
+		r->irqreload = 0;
+	} else {
+		r->irqcounter--;
+	}
+
+	if (r->irqcounter == 0 && r->irqenable)
+		cpuirqline(m, IRQMAPPER, 1);
+}
+
+
+static const struct mapper mappers[] = {
+	{ 0, "nrom",  NULL,     nrombanks,  nromwrite,  NULL },
+	{ 1, "mmc1",  mmc1init, mmc1banks,  mmc1write,  NULL },
+	{ 2, "uxrom", NULL,     uxrombanks, uxromwrite, NULL },
+	{ 3, "cnrom", NULL,     cnrombanks, cnromwrite, NULL },
+	{ 4, "mmc3",  mmc3init, mmc3banks,  mmc3write,  mmc3scanline },
+};
+
+
+const struct mapper *mapperfind(uint16_t number)
+{
+	for (size_t i = 0; i < sizeof(mappers)/sizeof(mappers[0]); i++) {
+		if (mappers[i].number == number)
+			return &mappers[i];
+	}
+
+	return NULL;
+}
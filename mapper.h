@@ -0,0 +1,24 @@
+#ifndef MAPPER_H_
+#define MAPPER_H_
+
+#include <stdint.h>
+
+// cartridge mappers. a mapper owns $8000-$FFFF: reads come straight out of
+// the prg rom through the bus page table and writes land in its registers.
+// a bank switch remaps the pages of the bank with busmaprom(), so it costs
+// a few pointer stores and nothing is added to plain reads.
+
+struct nemu_machine;
+
+struct mapper {
+	uint16_t number;    // iNES mapper number
+	const char *name;
+	void (*init)(struct nemu_machine *m);                            // power on registers, may be NULL
+	void (*banks)(struct nemu_machine *m);                           // map the banks the registers select
+	void (*write)(struct nemu_machine *m, uint16_t addr, uint8_t data);
+	void (*scanline)(struct nemu_machine *m);                        // NULL if it doesn't count them
+};
+
+const struct mapper *mapperfind(uint16_t number);    // NULL if unsupported
+
+#endif // MAPPER_H_
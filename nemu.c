@@ -1,13 +1,197 @@
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "machine.h"
+#include "rewind.h"
+
+
+#define REWINDBYTES (4 << 20)    // history kept for -r
+#define TRACERECORDS (1 << 20)   // instructions kept for -t
+#define PROFILETOP 64            // pcs listed by -o
+#define AUDIORATE 48000          // of the wav -A writes
+
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: nemu [-a loadaddr] [-e entry] [-p pc] [-w addr] [-c cycles] [-n] [-s state] [-m seed] [-S state] [-r cycles [-b steps]] [-R log | -P log] [-t trace] [-o profile [-F folded]] [-A wav] image\n\n"
+	        "  -S file    snapshot the machine to file when it stops\n"
+	        "  -r n       keep rewind history, a capture every n cycles\n"
+	        "  -b n       when it stops, go back n captures first\n"
+	        "  -R file    record input to file\n"
+	        "  -P file    play back input recorded with the same image and options\n"
+	        "  -t file    save the last instructions run to file, see tracedump\n"
+	        "  -o file    write a profile of the run to file\n"
+	        "  -F file    and its call stacks in folded form, for flame graphs\n"
+	        "  -A file    write what the apu plays to file, a 48 kHz wav\n%s", batchhelp);
+	exit(3);
+}
+
+
+static int writeprofile(const struct profile *p, const char *path, _Bool folded)
+{
+	FILE *f = fopen(path, "w");
+
+	if (f) {
+		if (folded)
+			profilefolded(p, f);
+		else
+			profilereport(p, f, PROFILETOP);
+		if (fclose(f) == 0)
+			return 0;
+	}
+
+	fprintf(stderr, "%s: %s\n", path, strerror(errno));
+	return -1;
+}
 
-#include "cpu.h"
 
 int main(int argc, char *argv[])
 {
-	while (1) {
-		cputick();
-		getc(stdin);
+	struct batchopts o;
+	struct batchresult r;
+	const char *save = NULL;
+	const char *record = NULL, *play = NULL;
+	const char *trace = NULL;
+	const char *profile = NULL, *folded = NULL;
+	const char *wav = NULL;
+	FILE *wavf = NULL;
+	struct inputlog log = { 0 };
+	long back = 0;
+	int rewound = 0;
+	int opt;
+
+	batchdefaults(&o);
+
+	while ((opt = getopt(argc, argv, "S:r:b:R:P:t:o:F:A:" BATCHOPTS)) != -1) {
+		if (opt == 'S')
+			save = optarg;
+		else if (opt == 'r')
+			o.rewindevery = strtoull(optarg, NULL, 0);
+		else if (opt == 'b')
+			back = atol(optarg);
+		else if (opt == 'R')
+			record = optarg;
+		else if (opt == 'P')
+			play = optarg;
+		else if (opt == 't')
+			trace = optarg;
+		else if (opt == 'o')
+			profile = optarg;
+		else if (opt == 'F')
+			folded = optarg;
+		else if (opt == 'A')
+			wav = optarg;
+		else if (batchopt(&o, opt, optarg) < 0)
+			usage();
+	}
+	if (optind != argc - 1 || (record && play) || (folded && !profile))
+		usage();
+#ifndef NEMU_TRACE
+	if (trace) {
+		fprintf(stderr, "nemu: built without tracing, rebuild with make TRACE=1\n");
+		return 3;
+	}
+#endif
+#ifndef NEMU_PROFILE
+	if (profile) {
+		fprintf(stderr, "nemu: built without profiling, rebuild with make PROFILE=1\n");
+		return 3;
+	}
+#endif
+
+	struct nemu_machine *m = nemu_new();
+
+	if (!m)
+		return 3;
+
+	if (batchload(m, argv[optind], &o) < 0) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		return 3;
 	}
 
-	return 0;
+	if (o.rewindevery && !(o.rewind = rewindnew(REWINDBYTES)))
+		return 3;
+
+	if (trace && !(m->trace = tracenew(TRACERECORDS)))
+		return 3;
+	if (profile && !(m->profile = profilenew()))
+		return 3;
+
+	if (wav) {
+		struct audio *a;
+
+		if (!(wavf = fopen(wav, "wb")) || !(a = audionew(AUDIORATE, wavf))) {
+			fprintf(stderr, "%s: %s\n", wav, strerror(errno));
+			return 3;
+		}
+		nemu_set_audio(m, a);
+	}
+
+	if (record)
+		inputrecord(m, &log);
+	if (play && (inputlogload(&log, play) < 0 || inputreplay(m, &log) < 0)) {
+		fprintf(stderr, "%s: %s\n", play, strerror(errno));
+		return 3;
+	}
+
+	batchrun(m, &o, &r);
+
+	if (wav) {
+		struct audio *a = m->audio;
+
+		nemu_set_audio(m, NULL);
+		if (audioclose(a) < 0 || fclose(wavf) != 0) {
+			fprintf(stderr, "%s: %s\n", wav, strerror(errno));
+			nemu_free(m);
+			return 3;
+		}
+	}
+
+	while (o.rewind && rewound < back && rewindstep(o.rewind, m) == 0)
+		rewound++;
+
+	printf("pc=%04X a=%02X x=%02X y=%02X s=%02X p=%02X cycles=%llu instructions=%llu stop=%s",
+	       m->cpu.pc, m->cpu.a, m->cpu.x, m->cpu.y, m->cpu.stkp, m->cpu.status,
+	       (unsigned long long)r.cycles, (unsigned long long)r.instructions,
+	       batchstopname[r.stop]);
+	if (r.stop == BATCH_WRITE)
+		printf(" value=%02X", r.value);
+	if (rewound)
+		printf(" rewound=%d clock=%llu", rewound, (unsigned long long)m->cpu.clock_count);
+	printf("\n");
+
+	if (save && batchsave(m, save) < 0) {
+		fprintf(stderr, "%s: %s\n", save, strerror(errno));
+		nemu_free(m);
+		return 3;
+	}
+
+	if (record && inputlogsave(&log, record) < 0) {
+		fprintf(stderr, "%s: %s\n", record, strerror(errno));
+		nemu_free(m);
+		return 3;
+	}
+
+	if (trace && tracesave(m->trace, trace) < 0) {
+		fprintf(stderr, "%s: %s\n", trace, strerror(errno));
+		nemu_free(m);
+		return 3;
+	}
+
+	if (profile && (writeprofile(m->profile, profile, 0) < 0 || (folded && writeprofile(m->profile, folded, 1) < 0))) {
+		nemu_free(m);
+		return 3;
+	}
+
+	inputlogfree(&log);
+	tracefree(m->trace);
+	profilefree(m->profile);
+	rewindfree(o.rewind);
+	nemu_free(m);
+
+	return batchstatus(&o, &r);
 }
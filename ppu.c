@@ -0,0 +1,730 @@
+#include <string.h>
+
+#include "machine.h"
+#include "mapper.h"
+#include "ppu.h"
+
+#if !defined(NEMU_SCALAR) && defined(__AVX2__)
+#include <immintrin.h>
+#define PPUAVX2
+#elif !defined(NEMU_SCALAR) && defined(__SSE2__)
+#include <emmintrin.h>
+#define PPUSSE2
+#endif
+
+#define PRERENDER (PPULINES - 1)
+
+// sprite pixels carry their flags above the palette index
+#define SPRBEHIND 0x20
+#define SPRZERO   0x40
+
+// the dots of a line something can happen on, after the first
+static const uint16_t stops[] = { 1, 256, 257, 260, 280, 340, PPUDOTS };
+
+
+// where nametable address addr lands in m->vram
+static uint16_t ntaddr(uint8_t mirror, uint16_t addr)
+{
+	switch (mirror) {
+	case MIRRORHORIZONTAL: return (addr >> 1 & 0x400) | (addr & 0x3FF);
+	case MIRRORVERTICAL:   return addr & 0x7FF;
+	case MIRRORSINGLELO:   return addr & 0x3FF;
+	case MIRRORSINGLEHI:   return 0x400 | (addr & 0x3FF);
+	default:               return addr & 0xFFF;
+	}
+}
+
+
+// $3F10, $3F14, $3F18 and $3F1C are the backdrop entries again
+static uint8_t palindex(uint16_t addr)
+{
+	addr &= 0x1F;
+	return (addr & 0x13) == 0x10 ? addr & 0x0F : addr;
+}
+
+
+static uint8_t chrread(struct nemu_machine *m, uint16_t addr)
+{
+	const uint8_t *bank = m->cart.chrbank[addr >> 10 & 7];
+
+	return bank ? bank[addr & 0x3FF] : 0x00;
+}
+
+
+static uint8_t vramread(struct nemu_machine *m, uint16_t addr)
+{
+	addr &= 0x3FFF;
+	if (addr < 0x2000)
+		return chrread(m, addr);
+	if (addr < 0x3F00)
+		return m->vram[ntaddr(m->cart.mirror, addr)];
+	return m->ppu.palette[palindex(addr)];
+}
+
+
+static void vramwrite(struct nemu_machine *m, uint16_t addr, uint8_t data)
+{
+	addr &= 0x3FFF;
+	if (addr < 0x2000) {
+		// only chr ram takes writes, the banks then point into the cart
+		if (m->cart.file && !m->cart.chr && m->cart.chrbank[addr >> 10])
+			((uint8_t *)m->cart.chrbank[addr >> 10])[addr & 0x3FF] = data;
+	} else if (addr < 0x3F00) {
+		m->vram[ntaddr(m->cart.mirror, addr)] = data;
+	} else {
+		m->ppu.palette[palindex(addr)] = data & 0x3F;
+	}
+}
+
+
+static _Bool rendering(const struct ppu *p)
+{
+	return p->mask & (MASKBG | MASKSPRITES);
+}
+
+
+// the lines the ppu fetches on while rendering
+static _Bool fetching(uint16_t line)
+{
+	return line < PPUHEIGHT || line == PRERENDER;
+}
+
+
+// a sprite on the line, fetched and ready to draw
+struct linesprite {
+	uint8_t x;
+	uint8_t lo;      // pattern planes, already flipped
+	uint8_t hi;
+	uint8_t attr;    // 0x10, its palette and the flags
+};
+
+
+void ppudecoderef(const uint8_t *lo, const uint8_t *hi, const uint8_t *attr, uint8_t *px, int n)
+{
+	for (int row = 0; row < n; row++) {
+		for (int i = 0; i < 8; i++) {
+			uint8_t c = (lo[row] >> (7 - i) & 1) | (hi[row] >> (7 - i) & 1) << 1;
+
+			px[row * 8 + i] = c ? attr[row] | c : 0;
+		}
+	}
+}
+
+
+// bit 7 - i of b to the bottom of byte i
+static uint64_t spread(uint8_t b)
+{
+	uint64_t t = (b * 0x0101010101010101u) & 0x0102040810204080u;
+
+	return (t + 0x7F7F7F7F7F7F7F7Fu) >> 7 & 0x0101010101010101u;
+}
+
+
+// a row eight pixels at a time in a 64 bit word, for the rows the vectors
+// leave over
+static void decoderow(uint8_t lo, uint8_t hi, uint8_t attr, uint8_t *px)
+{
+	uint64_t c = spread(lo) | spread(hi) << 1;
+	uint64_t opaque = ((c | c >> 1) & 0x0101010101010101u) * 0xFF;
+
+	c |= (attr * 0x0101010101010101u) & opaque;
+	for (int i = 0; i < 8; i++)
+		px[i] = c >> (i * 8);
+}
+
+
+#if defined(PPUAVX2)
+
+// four rows to a vector: each row's planes go to all eight of its bytes,
+// byte i keeps bit 7 - i
+static __m256i rows(__m256i b, __m256i which)
+{
+	return _mm256_shuffle_epi8(b, which);
+}
+
+void ppudecode(const uint8_t *lo, const uint8_t *hi, const uint8_t *attr, uint8_t *px, int n)
+{
+	const __m256i bits = _mm256_set1_epi64x(0x0102040810204080);
+	const __m256i first = _mm256_set_epi64x(0x0303030303030303, 0x0202020202020202, 0x0101010101010101, 0);
+	const __m256i second = _mm256_add_epi8(first, _mm256_set1_epi8(4));
+	const __m256i one = _mm256_set1_epi8(1), two = _mm256_set1_epi8(2);
+	int row = 0;
+
+	for (; row + 8 <= n; row += 8) {
+		uint64_t l, h, a;
+
+		memcpy(&l, lo + row, 8);
+		memcpy(&h, hi + row, 8);
+		memcpy(&a, attr + row, 8);
+
+		__m256i vl = _mm256_set1_epi64x(l), vh = _mm256_set1_epi64x(h), va = _mm256_set1_epi64x(a);
+
+		for (int half = 0; half < 2; half++) {
+			__m256i which = half ? second : first;
+			__m256i pl = _mm256_cmpeq_epi8(_mm256_and_si256(rows(vl, which), bits), bits);
+			__m256i ph = _mm256_cmpeq_epi8(_mm256_and_si256(rows(vh, which), bits), bits);
+			__m256i c = _mm256_or_si256(_mm256_and_si256(pl, one), _mm256_and_si256(ph, two));
+
+			c = _mm256_or_si256(c, _mm256_and_si256(rows(va, which), _mm256_or_si256(pl, ph)));
+			_mm256_storeu_si256((__m256i *)(px + (row + half * 4) * 8), c);
+		}
+	}
+
+	for (; row < n; row++)
+		decoderow(lo[row], hi[row], attr[row], px + row * 8);
+}
+
+#elif defined(PPUSSE2)
+
+// two rows to a vector: each row's planes go to all eight of its bytes,
+// byte i keeps bit 7 - i
+static void rows(const uint8_t *b, __m128i *out)
+{
+	__m128i x = _mm_loadl_epi64((const __m128i *)b);
+
+	x = _mm_unpacklo_epi8(x, x);
+
+	__m128i y0 = _mm_unpacklo_epi16(x, x), y1 = _mm_unpackhi_epi16(x, x);
+
+	out[0] = _mm_unpacklo_epi32(y0, y0);
+	out[1] = _mm_unpackhi_epi32(y0, y0);
+	out[2] = _mm_unpacklo_epi32(y1, y1);
+	out[3] = _mm_unpackhi_epi32(y1, y1);
+}
+
+void ppudecode(const uint8_t *lo, const uint8_t *hi, const uint8_t *attr, uint8_t *px, int n)
+{
+	const __m128i bits = _mm_set1_epi64x(0x0102040810204080);
+	const __m128i one = _mm_set1_epi8(1), two = _mm_set1_epi8(2);
+	int row = 0;
+
+	for (; row + 8 <= n; row += 8) {
+		__m128i vl[4], vh[4], va[4];
+
+		rows(lo + row, vl);
+		rows(hi + row, vh);
+		rows(attr + row, va);
+		for (int k = 0; k < 4; k++) {
+			__m128i pl = _mm_cmpeq_epi8(_mm_and_si128(vl[k], bits), bits);
+			__m128i ph = _mm_cmpeq_epi8(_mm_and_si128(vh[k], bits), bits);
+			__m128i c = _mm_or_si128(_mm_and_si128(pl, one), _mm_and_si128(ph, two));
+
+			c = _mm_or_si128(c, _mm_and_si128(va[k], _mm_or_si128(pl, ph)));
+			_mm_storeu_si128((__m128i *)(px + (row + k * 2) * 8), c);
+		}
+	}
+
+	for (; row < n; row++)
+		decoderow(lo[row], hi[row], attr[row], px + row * 8);
+}
+
+#else
+
+void ppudecode(const uint8_t *lo, const uint8_t *hi, const uint8_t *attr, uint8_t *px, int n)
+{
+	for (int row = 0; row < n; row++)
+		decoderow(lo[row], hi[row], attr[row], px + row * 8);
+}
+
+#endif
+
+
+static uint8_t reverse(uint8_t b)
+{
+	b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+	b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+	return (b & 0xAA) >> 1 | (b & 0x55) << 1;
+}
+
+
+// the background of the line into px, 0 where it is transparent
+static void drawbg(struct nemu_machine *m, uint8_t *px)
+{
+	struct ppu *p = &m->ppu;
+	uint8_t lo[PPUWIDTH / 8 + 1], hi[PPUWIDTH / 8 + 1], attr[PPUWIDTH / 8 + 1];
+	uint8_t tiles[PPUWIDTH + 8];
+	uint16_t v = p->v;
+	uint16_t base = p->ctrl & CTRLBG ? 0x1000 : 0x0000;
+
+	const uint8_t *nt = m->vram + ntaddr(m->cart.mirror, 0x2000 | (v & 0x0C00));
+
+	for (int tile = 0; tile < PPUWIDTH / 8 + 1; tile++) {
+		uint8_t name = nt[v & 0x3FF];
+		uint8_t at = nt[0x3C0 | (v >> 4 & 0x38) | (v >> 2 & 0x07)];
+		uint16_t addr = base + name * 16 + (v >> 12);
+
+		attr[tile] = (at >> ((v >> 4 & 4) | (v & 2)) & 3) << 2;
+		lo[tile] = chrread(m, addr);
+		hi[tile] = chrread(m, addr + 8);
+
+		// coarse x, wrapping into the nametable across
+		if ((v & 0x1F) == 31) {
+			v = (v & ~0x1F) ^ 0x400;
+			nt = m->vram + ntaddr(m->cart.mirror, 0x2000 | (v & 0x0C00));
+		} else {
+			v++;
+		}
+	}
+
+	ppudecode(lo, hi, attr, tiles, PPUWIDTH / 8 + 1);
+	memcpy(px, tiles + p->x, PPUWIDTH);
+	if (!(p->mask & MASKBGLEFT))
+		memset(px, 0, 8);
+}
+
+
+// sprite evaluation: the first eight sprites in oam on the line, fetched.
+// a ninth sets the overflow flag.
+static int findsprites(struct nemu_machine *m, struct linesprite *list)
+{
+	struct ppu *p = &m->ppu;
+	int height = p->ctrl & CTRLTALL ? 16 : 8;
+	int n = 0;
+
+	for (int i = 0; i < 64; i++) {
+		const uint8_t *s = m->oam + i * 4;
+		int row = p->line - s[0] - 1;    // sprites show a line below their y
+		uint16_t addr;
+
+		if (row < 0 || row >= height)
+			continue;
+		if (n == 8) {
+			p->status |= STATUSOVERFLOW;
+			break;
+		}
+
+		if (s[2] & 0x80)
+			row = height - 1 - row;
+		if (height == 16)
+			addr = (s[1] & 1) * 0x1000 + (s[1] & 0xFE) * 16 + (row & 8) * 2 + (row & 7);
+		else
+			addr = (p->ctrl & CTRLSPRITES ? 0x1000 : 0x0000) + s[1] * 16 + row;
+
+		struct linesprite *l = &list[n++];
+
+		l->x = s[3];
+		l->lo = chrread(m, addr);
+		l->hi = chrread(m, addr + 8);
+		if (s[2] & 0x40) {
+			l->lo = reverse(l->lo);
+			l->hi = reverse(l->hi);
+		}
+		l->attr = 0x10 | (s[2] & 3) << 2 | (s[2] & 0x20 ? SPRBEHIND : 0) | (i == 0 ? SPRZERO : 0);
+	}
+
+	return n;
+}
+
+
+// the sprites on the line into px, the first in oam wins where they overlap
+static void drawsprites(struct nemu_machine *m, const struct linesprite *list, int n, uint8_t *px)
+{
+	uint8_t lo[8], hi[8], attr[8], pat[8 * 8];
+
+	for (int i = 0; i < n; i++) {
+		lo[i] = list[i].lo;
+		hi[i] = list[i].hi;
+		attr[i] = list[i].attr;
+	}
+	ppudecode(lo, hi, attr, pat, n);
+
+	for (int i = 0; i < n; i++) {
+		const uint8_t *s = pat + i * 8;
+		int x = list[i].x;
+
+		for (int k = 0; k < 8 && x + k < PPUWIDTH; k++) {
+			if (s[k] && !px[x + k])
+				px[x + k] = s[k];
+		}
+	}
+
+	if (!(m->ppu.mask & MASKSPRLEFT))
+		memset(px, 0, 8);
+}
+
+
+// the whole of the line about to start, with the registers as they are now.
+// with no screen to draw on only what a sprite 0 hit needs is done.
+static void drawline(struct nemu_machine *m)
+{
+	struct ppu *p = &m->ppu;
+	uint8_t *out = m->screen ? m->screen + p->line * m->pitch : NULL;
+	uint8_t bg[PPUWIDTH] = { 0 }, spr[PPUWIDTH] = { 0 };
+	uint8_t gray = p->mask & MASKGRAY ? 0x30 : 0x3F;
+	uint8_t pal[32];
+	struct linesprite list[8];
+	int n = 0;
+	_Bool hit;
+
+	if (p->mask & MASKSPRITES)
+		n = findsprites(m, list);
+	hit = n && (list[0].attr & SPRZERO) && (p->mask & MASKBG) && !p->hitcol && !(p->status & STATUSHIT);
+
+	if (!out && !hit)
+		return;
+
+	if (p->mask & MASKBG)
+		drawbg(m, bg);
+	if (n)
+		drawsprites(m, list, n, spr);
+
+	// not on the last pixel
+	for (int x = 0; hit && x < PPUWIDTH - 1; x++) {
+		if ((spr[x] & SPRZERO) && (spr[x] & 3) && (bg[x] & 3)) {
+			p->hitcol = x + 1;
+			hit = 0;
+		}
+	}
+
+	if (!out)
+		return;
+
+	for (int i = 0; i < 32; i++)
+		pal[i] = p->palette[i] & gray;
+	if (!n) {
+		for (int x = 0; x < PPUWIDTH; x++)
+			out[x] = pal[bg[x]];
+		return;
+	}
+	for (int x = 0; x < PPUWIDTH; x++) {
+		uint8_t b = bg[x], s = spr[x];
+
+		out[x] = pal[(s & 3) && (!(b & 3) || !(s & SPRBEHIND)) ? s & 0x1F : b];
+	}
+}
+
+
+static void newline(struct nemu_machine *m)
+{
+	struct ppu *p = &m->ppu;
+
+	p->col = 0;
+	p->hitcol = 0;
+	if (++p->line == PPULINES) {
+		p->line = 0;
+		p->frame++;
+		p->odd ^= 1;
+	}
+
+	if (p->line < PPUHEIGHT)
+		drawline(m);
+}
+
+
+static void incy(struct ppu *p)
+{
+	if ((p->v & 0x7000) != 0x7000) {
+		p->v += 0x1000;
+		return;
+	}
+
+	uint16_t y = p->v >> 5 & 0x1F;
+
+	p->v &= ~0x7000;
+	if (y == 29) {
+		y = 0;
+		p->v ^= 0x0800;
+	} else if (y == 31) {
+		y = 0;
+	} else {
+		y++;
+	}
+	p->v = (p->v & ~0x03E0) | y << 5;
+}
+
+
+// what happens on reaching p->col
+static void arrive(struct nemu_machine *m)
+{
+	struct ppu *p = &m->ppu;
+	_Bool fetch = rendering(p) && fetching(p->line);
+
+	if (p->col == p->hitcol) {
+		p->status |= STATUSHIT;
+		p->hitcol = 0;
+	}
+
+	switch (p->col) {
+	case 1:
+		if (p->line == PPUHEIGHT + 1) {
+			p->status |= STATUSVBLANK;
+			if (p->ctrl & CTRLNMI)
+				cpunmi(m);
+		} else if (p->line == PRERENDER) {
+			p->status = 0;
+		}
+		break;
+	case 256:
+		if (fetch)
+			incy(p);
+		break;
+	case 257:
+		if (fetch)
+			p->v = (p->v & ~0x041F) | (p->t & 0x041F);
+		break;
+	case 260:
+		if (fetch)
+			cartscanline(m);
+		break;
+	case 280:
+		if (fetch && p->line == PRERENDER)
+			p->v = (p->v & ~0x7BE0) | (p->t & 0x7BE0);
+		break;
+	case 340:
+		// odd frames skip the last dot of the pre-render line
+		if (fetch && p->line == PRERENDER && p->odd)
+			newline(m);
+		break;
+	}
+}
+
+
+// run the ppu up to dot target, a stop at a time
+static void run(struct nemu_machine *m, uint64_t target)
+{
+	struct ppu *p = &m->ppu;
+	uint64_t frame = p->frame;
+	uint16_t line = p->line;
+
+	while (p->dot < target) {
+		uint16_t stop = PPUDOTS;
+
+		for (size_t i = 0; i < sizeof(stops) / sizeof(stops[0]); i++) {
+			if (stops[i] > p->col) {
+				stop = stops[i];
+				break;
+			}
+		}
+		if (p->hitcol > p->col && p->hitcol < stop)
+			stop = p->hitcol;
+
+		uint64_t n = stop - p->col;
+
+		if (n > target - p->dot)
+			n = target - p->dot;
+		p->dot += n;
+		p->col += n;
+
+		if (p->col == PPUDOTS)
+			newline(m);
+		else if (p->col == stop)
+			arrive(m);
+	}
+
+	// a new line can bring a sprite 0 hit or a change of plan
+	if (p->line != line || p->frame != frame)
+		ppuschedule(m);
+}
+
+
+void ppusync(struct nemu_machine *m)
+{
+	run(m, m->cpu.clock_count * 3);
+}
+
+
+// dots from where the ppu is to line and col, the same place a frame on
+static uint64_t dotsto(const struct ppu *p, uint16_t line, uint16_t col)
+{
+	int64_t d = ((int64_t)line - p->line) * PPUDOTS + ((int64_t)col - p->col);
+
+	if (d <= 0)
+		d += PPULINES * PPUDOTS - (rendering(p) && p->odd);
+	return d;
+}
+
+
+// dots to the next time a fetching line reaches col
+static uint64_t nextfetch(const struct ppu *p, uint16_t col)
+{
+	uint16_t line = p->line;
+
+	if (!fetching(line) || p->col >= col) {
+		do
+			line = (line + 1) % PPULINES;
+		while (!fetching(line));
+	}
+
+	return dotsto(p, line, col);
+}
+
+
+// the next dot the cpu has to hear about: vblank and its nmi, the flags
+// clearing, a sprite 0 hit, the cart's scanline counter, and every line
+// that could bring a hit while the cpu polls $2002
+void ppuschedule(struct nemu_machine *m)
+{
+	struct ppu *p = &m->ppu;
+	uint64_t d = dotsto(p, PPUHEIGHT + 1, 1);
+	uint64_t e = dotsto(p, PRERENDER, 1);
+
+	if (e < d)
+		d = e;
+	if (p->hitcol > p->col && (e = p->hitcol - p->col) < d)
+		d = e;
+	if (rendering(p) && m->cart.hw && m->cart.hw->scanline && (e = nextfetch(p, 260)) < d)
+		d = e;
+	if (rendering(p) && p->polled && p->line < PPUHEIGHT - 1 && (e = dotsto(p, p->line + 1, 0)) < d)
+		d = e;
+	if (rendering(p) && p->polled && p->line == PRERENDER && (e = dotsto(p, 0, 0)) < d)
+		d = e;
+
+	schedat(m, SCHEDPPU, (p->dot + d + 2) / 3);
+}
+
+
+void ppuevent(struct nemu_machine *m)
+{
+	m->ppu.polled = 0;
+	ppusync(m);
+	ppuschedule(m);
+}
+
+
+static uint8_t regread(struct nemu_machine *m, uint16_t addr)
+{
+	struct ppu *p = &m->ppu;
+	uint8_t data = p->latch;
+
+	ppusync(m);
+
+	switch (addr & 7) {
+	case 2:
+		data = (p->status & 0xE0) | (p->latch & 0x1F);
+		p->status &= ~STATUSVBLANK;
+		p->w = 0;
+		break;
+	case 4:
+		data = m->oam[p->oamaddr];
+		if ((p->oamaddr & 3) == 2)
+			data &= 0xE3;
+		break;
+	case 7:
+		// palette reads are immediate, the buffer gets the nametable under them
+		data = p->readbuf;
+		p->readbuf = vramread(m, p->v);
+		if ((p->v & 0x3FFF) >= 0x3F00) {
+			data = (p->readbuf & 0x3F) | (p->latch & 0xC0);
+			p->readbuf = vramread(m, p->v - 0x1000);
+		}
+		p->v += p->ctrl & CTRLINC32 ? 32 : 1;
+		break;
+	}
+
+	return data;
+}
+
+
+static void regwrite(struct nemu_machine *m, uint16_t addr, uint8_t data)
+{
+	struct ppu *p = &m->ppu;
+
+	ppusync(m);
+	p->latch = data;
+
+	switch (addr & 7) {
+	case 0:
+		// turning the nmi on in vblank raises it straight away
+		if (!(p->ctrl & CTRLNMI) && (data & CTRLNMI) && (p->status & STATUSVBLANK))
+			cpunmi(m);
+		p->ctrl = data;
+		p->t = (p->t & ~0x0C00) | (data & 3) << 10;
+		break;
+	case 1:
+		p->mask = data;
+		ppuschedule(m);
+		break;
+	case 3:
+		p->oamaddr = data;
+		break;
+	case 4:
+		m->oam[p->oamaddr++] = data;
+		break;
+	case 5:
+		if (!p->w) {
+			p->t = (p->t & ~0x001F) | data >> 3;
+			p->x = data & 7;
+		} else {
+			p->t = (p->t & 0x8C1F) | (data & 7) << 12 | (data & 0xF8) << 2;
+		}
+		p->w ^= 1;
+		break;
+	case 6:
+		if (!p->w) {
+			p->t = (p->t & 0x00FF) | (data & 0x3F) << 8;
+		} else {
+			p->t = (p->t & 0xFF00) | data;
+			p->v = p->t;
+		}
+		p->w ^= 1;
+		break;
+	case 7:
+		vramwrite(m, p->v, data);
+		p->v += p->ctrl & CTRLINC32 ? 32 : 1;
+		break;
+	}
+}
+
+
+// $2002 is what games poll. its bits only change on dots ppuschedule()
+// knows about, once it wakes the cpu on every line that could bring a
+// sprite 0 hit, so an idle loop reading it can be skipped up to the next
+// event.
+static _Bool ppusteady(struct nemu_machine *m, uint16_t addr)
+{
+	if ((addr & 7) != 2)
+		return 0;
+
+	if (!m->ppu.polled) {
+		m->ppu.polled = 1;
+		ppusync(m);
+		ppuschedule(m);
+	}
+	return 1;
+}
+
+static const struct devonbus ppubus = { 0x2000, 0x2007, regwrite, regread, ppusteady };
+
+
+// a sprite dma, the 256 bytes of page written to $2004 in turn. plain
+// memory is copied in one go, anything else read a byte at a time as the
+// dma would. the cpu sits it out.
+void ppudma(struct nemu_machine *m, uint8_t page)
+{
+	struct ppu *p = &m->ppu;
+	const uint8_t *src = m->bus.page[page].rd;
+	uint8_t at = p->oamaddr;
+
+	ppusync(m);
+	if (src) {
+		memcpy(m->oam + at, src, BUSPAGESIZE - at);
+		memcpy(m->oam, src + BUSPAGESIZE - at, at);
+	} else {
+		for (int i = 0; i < BUSPAGESIZE; i++)
+			m->oam[(uint8_t)(at + i)] = busread(m, page << 8 | i, 0);
+	}
+	p->latch = m->oam[(uint8_t)(at - 1)];
+
+	cpustall(m, 513, 1);
+}
+
+
+void ppuinit(struct nemu_machine *m)
+{
+	memset(&m->ppu, 0, sizeof(m->ppu));
+	memset(m->vram, 0, sizeof(m->vram));
+	memset(m->oam, 0, sizeof(m->oam));
+	m->ppu.on = 1;
+	m->ppu.dot = m->cpu.clock_count * 3;
+
+	busmapio(m, &ppubus);
+	busmirror(m, 0x2000, 0x3FFF, 8);
+	ppuschedule(m);
+}
+
+
+void nemu_set_screen(struct nemu_machine *m, uint8_t *px, size_t pitch)
+{
+	m->screen = px;
+	m->pitch = pitch;
+}
@@ -0,0 +1,86 @@
+#ifndef PPU_H_
+#define PPU_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the picture processor, ntsc timing. it is not ticked along with the cpu:
+// it runs three dots per cpu cycle but only catches up when something
+// could tell the difference, when the cpu touches $2000-$3FFF, and on a
+// scheduled event when vblank starts and the nmi is due, when the pre-render
+// line clears the flags, and on the dots the cart's scanline counter or a
+// sprite 0 hit need. catching up walks whole scanlines, a line is drawn
+// in one go when the ppu reaches its first dot, into the screen the caller
+// gave nemu_set_screen(). with none only a sprite 0 hit is looked for.
+
+#define PPUWIDTH  256
+#define PPUHEIGHT 240
+#define PPUDOTS   341     // dots per scanline
+#define PPULINES  262     // scanlines per frame
+#define PPUVRAM   0x1000  // nametable ram, 2K on the board plus 2K for four screen carts
+
+enum PPUCTRL {
+	CTRLINC32    = (1 << 2),    // $2007 steps by 32
+	CTRLSPRITES  = (1 << 3),    // 8x8 sprites from $1000
+	CTRLBG       = (1 << 4),    // background from $1000
+	CTRLTALL     = (1 << 5),    // 8x16 sprites
+	CTRLNMI      = (1 << 7),
+};
+
+enum PPUMASK {
+	MASKGRAY     = (1 << 0),
+	MASKBGLEFT   = (1 << 1),    // background in the leftmost 8 pixels
+	MASKSPRLEFT  = (1 << 2),
+	MASKBG       = (1 << 3),
+	MASKSPRITES  = (1 << 4),
+};
+
+enum PPUSTATUS {
+	STATUSOVERFLOW = (1 << 5),
+	STATUSHIT      = (1 << 6),    // sprite 0 hit
+	STATUSVBLANK   = (1 << 7),
+};
+
+struct ppu {
+	uint8_t on;          // ppuinit() put it on the bus
+	uint8_t ctrl;
+	uint8_t mask;
+	uint8_t status;
+	uint8_t oamaddr;
+	uint16_t v;          // vram address and scroll, see nesdev's "ppu scrolling"
+	uint16_t t;
+	uint8_t x;           // fine x scroll
+	uint8_t w;           // first or second write to $2005/$2006
+	uint8_t readbuf;     // $2007 reads come one access late
+	uint8_t latch;       // the last value written, what write only registers read back
+	uint8_t palette[32];
+
+	uint64_t dot;        // dots run since power on, three per cpu cycle
+	uint64_t frame;      // frames finished
+	uint16_t line;       // where dot is, 261 is the pre-render line
+	uint16_t col;
+	uint16_t hitcol;     // dot of this line sprite 0 hits on, 0 for none
+	uint8_t odd;         // odd frames are a dot shorter while rendering
+	uint8_t polled;      // the cpu is polling $2002, see ppusteady()
+};
+
+struct nemu_machine;
+
+void ppuinit(struct nemu_machine *m);     // power on and put the registers on the bus
+void ppusync(struct nemu_machine *m);     // catch up with the cpu
+void ppuevent(struct nemu_machine *m);    // the scheduler's call
+void ppuschedule(struct nemu_machine *m); // work out when the next event is due, after a state load say
+void ppudma(struct nemu_machine *m, uint8_t page);    // $4014, copy page to oam
+
+// where frames go, PPUHEIGHT lines of PPUWIDTH nes palette indices pitch
+// bytes apart, or NULL to not draw them
+void nemu_set_screen(struct nemu_machine *m, uint8_t *px, size_t pitch);
+
+// n rows of 2bpp pattern, lo and hi the bit planes with the leftmost pixel
+// in bit 7, into eight pixels each of attr | color, 0 where transparent.
+// ppudecode() uses AVX2 or SSE2 when the build has them (make SCALAR=1
+// for neither), ppudecoderef() is the plain c it is checked against.
+void ppudecode(const uint8_t *lo, const uint8_t *hi, const uint8_t *attr, uint8_t *px, int n);
+void ppudecoderef(const uint8_t *lo, const uint8_t *hi, const uint8_t *attr, uint8_t *px, int n);
+
+#endif // PPU_H_
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "profile.h"
+
+// a row of the report
+struct row {
+	char name[16];
+	uint32_t key;
+	uint64_t count;
+	uint64_t cycles;
+};
+
+
+struct profile *profilenew(void)
+{
+	struct profile *p = calloc(1, sizeof(*p));
+
+	if (!p)
+		return NULL;
+
+	p->cap = 1024;
+	p->hashsize = 2048;
+	p->node = malloc(p->cap * sizeof(*p->node));
+	p->hash = malloc(p->hashsize * sizeof(*p->hash));
+	if (!p->node || !p->hash) {
+		profilefree(p);
+		return NULL;
+	}
+
+	profileclear(p);
+	return p;
+}
+
+
+void profilefree(struct profile *p)
+{
+	if (!p)
+		return;
+
+	free(p->node);
+	free(p->hash);
+	free(p);
+}
+
+
+void profileclear(struct profile *p)
+{
+	memset(p->opcount, 0, sizeof(p->opcount));
+	memset(p->opcycles, 0, sizeof(p->opcycles));
+	memset(p->pccount, 0, sizeof(p->pccount));
+	memset(p->pccycles, 0, sizeof(p->pccycles));
+	memset(p->hash, 0, p->hashsize * sizeof(*p->hash));
+
+	p->node[0] = (struct profilenode){ 0 };
+	p->nnodes = 1;
+	p->depth = 0;
+	p->over = 0;
+}
+
+
+static uint32_t slot(const struct profile *p, uint32_t parent, uint16_t addr, uint8_t line)
+{
+	uint32_t h = (parent * 0x9E3779B1u) ^ (addr * 0x85EBCA6Bu) ^ line;
+
+	h &= p->hashsize - 1;
+	while (p->hash[h]) {
+		const struct profilenode *n = &p->node[p->hash[h] - 1];
+
+		if (n->parent == parent && n->addr == addr && n->line == line)
+			break;
+		h = (h + 1) & (p->hashsize - 1);
+	}
+
+	return h;
+}
+
+
+// the node for a frame entered at addr from parent, made on first use. if
+// memory runs out the caller's frame is used instead.
+static uint32_t child(struct profile *p, uint32_t parent, uint16_t addr, uint8_t line)
+{
+	uint32_t h = slot(p, parent, addr, line);
+
+	if (p->hash[h])
+		return p->hash[h] - 1;
+
+	if (p->nnodes == p->cap) {
+		struct profilenode *node = realloc(p->node, p->cap * 2 * sizeof(*node));
+
+		if (!node)
+			return parent;
+		p->node = node;
+		p->cap *= 2;
+	}
+
+	// keep the table at most half full
+	if (p->nnodes * 2 >= p->hashsize) {
+		uint32_t *hash = calloc(p->hashsize * 2, sizeof(*hash));
+
+		if (!hash)
+			return parent;
+
+		free(p->hash);
+		p->hash = hash;
+		p->hashsize *= 2;
+		for (uint32_t i = 1; i < p->nnodes; i++)
+			p->hash[slot(p, p->node[i].parent, p->node[i].addr, p->node[i].line)] = i + 1;
+		h = slot(p, parent, addr, line);
+	}
+
+	p->node[p->nnodes] = (struct profilenode){ parent, addr, line, 0 };
+	p->hash[h] = ++p->nnodes;
+	return p->nnodes - 1;
+}
+
+
+static void enter(struct profile *p, uint16_t addr, uint8_t line)
+{
+	if (p->depth == PROFILEDEPTH) {
+		p->over++;
+		return;
+	}
+
+	uint32_t parent = p->depth ? p->stack[p->depth - 1] : 0;
+
+	p->stack[p->depth++] = child(p, parent, addr, line);
+}
+
+
+// an RTS or RTI with no frame to leave, a jump through the stack say, is
+// not a return
+static void leave(struct profile *p)
+{
+	if (p->over)
+		p->over--;
+	else if (p->depth)
+		p->depth--;
+}
+
+
+void profileop(struct profile *p, uint16_t pc, uint8_t opcode, uint8_t cycles, uint16_t next)
+{
+	p->opcount[opcode]++;
+	p->opcycles[opcode] += cycles;
+	p->pccount[pc]++;
+	p->pccycles[pc] += cycles;
+	p->node[p->depth ? p->stack[p->depth - 1] : 0].cycles += cycles;
+
+	switch (opcode) {
+	case 0x20:    // JSR
+		enter(p, next, 0);
+		break;
+	case 0x40:    // RTI
+	case 0x60:    // RTS
+		leave(p);
+		break;
+	}
+}
+
+
+void profileinterrupt(struct profile *p, uint8_t line, uint16_t pc, uint8_t cycles)
+{
+	enter(p, pc, line);
+	p->node[p->depth ? p->stack[p->depth - 1] : 0].cycles += cycles;
+}
+
+
+static int bycycles(const void *a, const void *b)
+{
+	const struct row *x = a, *y = b;
+
+	if (x->cycles != y->cycles)
+		return x->cycles < y->cycles ? 1 : -1;
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+
+static void table(FILE *f, const char *title, struct row *rows, size_t n, uint64_t total, size_t top)
+{
+	qsort(rows, n, sizeof(*rows), bycycles);
+	if (top && n > top)
+		n = top;
+
+	fprintf(f, "\n%-12s %12s %14s %7s %7s\n", title, "count", "cycles", "cyc/ins", "%cyc");
+	for (size_t i = 0; i < n && rows[i].count; i++) {
+		fprintf(f, "%-12s %12llu %14llu %7.2f %6.2f%%\n", rows[i].name,
+		        (unsigned long long)rows[i].count, (unsigned long long)rows[i].cycles,
+		        (double)rows[i].cycles / rows[i].count, total ? 100.0 * rows[i].cycles / total : 0.0);
+	}
+}
+
+
+// sum the opcode counters into rows keyed by name, one per distinct name
+static size_t group(const struct profile *p, struct row *rows, _Bool bymode)
+{
+	size_t n = 0;
+
+	for (int op = 0; op < 256; op++) {
+		const char *name = bymode ? lookup[op].mode : lookup[op].name;
+		size_t i;
+
+		for (i = 0; i < n && strcmp(rows[i].name, name) != 0; i++)
+			;
+		if (i == n) {
+			rows[n++] = (struct row){ .key = op };
+			snprintf(rows[i].name, sizeof(rows[i].name), "%s", name);
+		}
+		rows[i].count += p->opcount[op];
+		rows[i].cycles += p->opcycles[op];
+	}
+
+	return n;
+}
+
+
+void profilereport(const struct profile *p, FILE *f, int top)
+{
+	struct row rows[256];
+	uint64_t count = 0, cycles = 0;
+	size_t n = 0;
+
+	for (int op = 0; op < 256; op++) {
+		count += p->opcount[op];
+		cycles += p->opcycles[op];
+	}
+	fprintf(f, "%llu instructions, %llu cycles\n", (unsigned long long)count, (unsigned long long)cycles);
+
+	for (int op = 0; op < 256; op++) {
+		rows[op] = (struct row){ .key = op, .count = p->opcount[op], .cycles = p->opcycles[op] };
+		snprintf(rows[op].name, sizeof(rows[op].name), "%02X %s %s", op, lookup[op].name, lookup[op].mode);
+	}
+	table(f, "opcode", rows, 256, cycles, 0);
+
+	table(f, "mode", rows, group(p, rows, 1), cycles, 0);
+	table(f, "operation", rows, group(p, rows, 0), cycles, 0);
+
+	struct row *pcs = malloc(0x10000 * sizeof(*pcs));
+
+	if (!pcs)
+		return;
+	for (uint32_t pc = 0; pc < 0x10000; pc++) {
+		if (!p->pccount[pc])
+			continue;
+		pcs[n] = (struct row){ .key = pc, .count = p->pccount[pc], .cycles = p->pccycles[pc] };
+		snprintf(pcs[n].name, sizeof(pcs[n].name), "$%04X", pc);
+		n++;
+	}
+	table(f, "pc", pcs, n, cycles, top);
+	free(pcs);
+}
+
+
+// one line per call stack with cycles spent in its innermost frame:
+// root;$8030;nmi:$C000 1234
+void profilefolded(const struct profile *p, FILE *f)
+{
+	uint32_t path[PROFILEDEPTH + 1];
+
+	for (uint32_t i = 0; i < p->nnodes; i++) {
+		const struct profilenode *n = &p->node[i];
+		int depth = 0;
+
+		if (!n->cycles)
+			continue;
+
+		for (uint32_t k = i; k; k = p->node[k].parent)
+			path[depth++] = k;
+
+		fprintf(f, "root");
+		while (depth--) {
+			const struct profilenode *frame = &p->node[path[depth]];
+
+			fprintf(f, ";%s$%04X", frame->line == NMILINE ? "nmi:" : frame->line ? "irq:" : "", frame->addr);
+		}
+		fprintf(f, " %llu\n", (unsigned long long)n->cycles);
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+// execution profile. built with -DNEMU_PROFILE, a run with m->profile set
+// counts instructions and cycles per opcode and per pc, and keeps a call
+// tree from JSR/RTS and interrupts/RTI so cycles can be charged to call
+// stacks. like the trace it steps through the table core, the fused cores
+// are left alone. profilereport() sorts the counters per opcode, per
+// addressing mode, per operation and per pc; profilefolded() writes the
+// stacks in the folded format flamegraph.pl and friends read.
+
+#define PROFILEDEPTH 64    // deeper calls are charged to the frame at the limit
+
+struct profilenode {
+	uint32_t parent;
+	uint16_t addr;         // where the frame was entered
+	uint8_t line;          // interrupt line that entered it, 0 for a call
+	uint64_t cycles;       // spent in the frame itself
+};
+
+struct profile {
+	uint64_t opcount[256];
+	uint64_t opcycles[256];
+	uint64_t pccount[0x10000];
+	uint64_t pccycles[0x10000];
+
+	struct profilenode *node;    // node 0 is the root
+	uint32_t nnodes;
+	uint32_t cap;
+	uint32_t *hash;              // node index + 1 by (parent, addr, line), 0 is empty
+	uint32_t hashsize;
+
+	uint32_t stack[PROFILEDEPTH];
+	int depth;                   // frames above the root
+	int over;                    // calls past PROFILEDEPTH not given a frame
+};
+
+struct profile *profilenew(void);    // NULL without memory
+void profilefree(struct profile *p);
+void profileclear(struct profile *p);
+
+// from the cpu: an instruction at pc retired, and pc is now next
+void profileop(struct profile *p, uint16_t pc, uint8_t opcode, uint8_t cycles, uint16_t next);
+// an interrupt on line jumped to pc
+void profileinterrupt(struct profile *p, uint8_t line, uint16_t pc, uint8_t cycles);
+
+void profilereport(const struct profile *p, FILE *f, int top);    // top pcs, 0 for all
+void profilefolded(const struct profile *p, FILE *f);
+
+#endif // PROFILE_H_
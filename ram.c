@@ -1,13 +1,181 @@
-#include "ram.h"
+#include <stdlib.h>
+#include <string.h>
 
+#include "machine.h"
 
-uint8_t ramread(uint16_t addr)
+
+void raminit(struct nemu_machine *m)
+{
+	memset(m->ram, 0, sizeof(m->ram));
+	busmapmem(m, 0x0000, 0xFFFF, m->ram, 1);
+}
+
+
+// the nes has 2K of ram, mirrored four times up to $2000. $2000 and up
+// keep the flat ram until something else is mapped there.
+void ramnes(struct nemu_machine *m)
+{
+	busmapmem(m, 0x0000, 0x07FF, m->ram, 1);
+	busmirror(m, 0x0000, 0x1FFF, 0x0800);
+}
+
+
+// pages that are ram, at the page of it they read
+static int rampageof(struct nemu_machine *m, const uint8_t *p)
+{
+	if (p < m->ram || p >= m->ram + RAMSIZE)
+		return -1;
+
+	return (p - m->ram) / BUSPAGESIZE;
+}
+
+
+static _Bool owned(struct nemu_machine *m, int page)
+{
+	return !m->shared || m->owned[page >> 3] >> (page & 7) & 1;
+}
+
+
+static void unshare(struct ramblock *b, unsigned n)
+{
+	if (atomic_fetch_sub(&b->refs, n) == n)
+		free(b);
+}
+
+
+// references to blocks are taken and dropped a run of pages at a time
+static void blockrefs(struct ramset *s, _Bool take)
+{
+	struct ramblock *b = s->block[0];
+	unsigned n = 0;
+
+	for (int i = 0; i <= RAMPAGES; i++) {
+		if (i < RAMPAGES && s->block[i] == b) {
+			n++;
+			continue;
+		}
+		if (take)
+			atomic_fetch_add(&b->refs, n);
+		else
+			unshare(b, n);
+		if (i < RAMPAGES) {
+			b = s->block[i];
+			n = 1;
+		}
+	}
+}
+
+
+static void setrelease(struct ramset *s)
+{
+	if (s && atomic_fetch_sub(&s->refs, 1) == 1) {
+		blockrefs(s, 0);
+		free(s);
+	}
+}
+
+
+// the pages ram[] has are frozen into a new block and a new set, the bus
+// reads them there and writes trap to ramown(). with none, the set stays
+// as it is. ram is only ever mapped in whole pages.
+int ramfreeze(struct nemu_machine *m)
+{
+	struct ramset *old = m->shared, *s;
+	struct ramblock *b;
+	int n = 0;
+
+	for (int i = 0; old && i < RAMPAGES / 8; i++)
+		n |= m->owned[i];
+	if (old && !n)
+		return 0;
+
+	n = 0;
+	for (int i = 0; i < RAMPAGES; i++)
+		n += owned(m, i);
+
+	if (!(s = malloc(sizeof(*s))))
+		return -1;
+	if (!(b = malloc(sizeof(*b) + n * BUSPAGESIZE))) {
+		free(s);
+		return -1;
+	}
+	atomic_init(&s->refs, 1);
+	atomic_init(&b->refs, 0);
+
+	for (int i = 0, k = 0; i < RAMPAGES; i++) {
+		if (owned(m, i)) {
+			memcpy(b->data[k], m->ram + i * BUSPAGESIZE, BUSPAGESIZE);
+			s->block[i] = b;
+			s->data[i] = b->data[k++];
+		} else {
+			s->block[i] = old->block[i];
+			s->data[i] = old->data[i];
+		}
+	}
+	blockrefs(s, 1);
+	setrelease(old);
+	m->shared = s;
+	memset(m->owned, 0, sizeof(m->owned));
+
+	for (int i = 0; i < BUSPAGES; i++) {
+		struct buspage *p = &m->bus.page[i];
+		int page = rampageof(m, p->rd);
+
+		if (page < 0)
+			continue;
+		// the bus never writes through rd
+		p->rd = (uint8_t *)s->data[page];
+		if (p->mem) {
+			p->watch |= WATCHCOW;
+			p->wr = NULL;
+		}
+	}
+
+	return 0;
+}
+
+
+void ramshare(struct nemu_machine *f, struct nemu_machine *m)
+{
+	f->shared = m->shared;
+	if (f->shared)
+		atomic_fetch_add(&f->shared->refs, 1);
+	memcpy(f->owned, m->owned, sizeof(f->owned));
+}
+
+
+void ramown(struct nemu_machine *m, int page)
+{
+	uint8_t *own = m->ram + page * BUSPAGESIZE;
+	const uint8_t *data;
+
+	if (owned(m, page))
+		return;
+
+	data = m->shared->data[page];
+	memcpy(own, data, BUSPAGESIZE);
+	m->owned[page >> 3] |= 1 << (page & 7);
+
+	for (int i = 0; i < BUSPAGES; i++) {
+		struct buspage *p = &m->bus.page[i];
+
+		if (p->rd != data)
+			continue;
+		p->rd = own;
+		if (p->mem && !(p->watch &= ~WATCHCOW))
+			p->wr = p->mem;
+	}
+}
+
+
+const uint8_t *ramview(struct nemu_machine *m, int page)
 {
-	return ram[addr];
+	return owned(m, page) ? m->ram + page * BUSPAGESIZE : m->shared->data[page];
 }
 
 
-void ramwrite(uint16_t addr, uint8_t data)
+void ramrelease(struct nemu_machine *m)
 {
-	ram[addr] = data;
+	setrelease(m->shared);
+	m->shared = NULL;
 }
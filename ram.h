@@ -1,11 +1,38 @@
 #ifndef RAM_H_
 #define RAM_H_
 
+#include <stdatomic.h>
 #include <stdint.h>
 
-uint8_t ram[64 * 1024];
+#include "bus.h"
 
-uint8_t ramread(uint16_t addr);
-void ramwrite(uint16_t addr, uint8_t data);
+#define RAMSIZE  (64 * 1024)
+#define RAMPAGES (RAMSIZE / BUSPAGESIZE)
+
+// ram frozen by nemu_fork(). a block holds the pages of one freeze, a set
+// says which block each page of ram is in now. the machine and its forks
+// all read the set until they write to a page, which gets them their own
+// copy of it back in ram[].
+struct ramblock {
+	atomic_uint refs;    // pages of sets in it
+	uint8_t data[][BUSPAGESIZE];
+};
+
+struct ramset {
+	atomic_uint refs;    // machines reading it
+	struct ramblock *block[RAMPAGES];
+	const uint8_t *data[RAMPAGES];
+};
+
+struct nemu_machine;
+
+void raminit(struct nemu_machine *m);    // clear ram and map it over the whole bus
+void ramnes(struct nemu_machine *m);     // cut it down to the nes' 2K at $0000-$1FFF
+
+int ramfreeze(struct nemu_machine *m);   // share every page not shared yet, -1 without memory
+void ramshare(struct nemu_machine *f, struct nemu_machine *m);    // f reads m's frozen pages too
+void ramown(struct nemu_machine *m, int page);       // copy a shared page back, before writing it
+const uint8_t *ramview(struct nemu_machine *m, int page);    // where the page's bytes are now
+void ramrelease(struct nemu_machine *m);  // let go of the shared pages, for a machine going away
 
 #endif // RAM_H_
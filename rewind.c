@@ -0,0 +1,367 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "machine.h"
+#include "mapper.h"
+#include "rewind.h"
+
+#define CHRPAGES (CARTCHRRAM / BUSPAGESIZE)
+#define PPUPAGES (PPUVRAM / BUSPAGESIZE + 1)
+#define NPAGES   (RAMPAGES + CHRPAGES + PPUPAGES)    // ram, the cart's chr ram, then vram and oam
+#define LASTPAGE 0xFFFF                   // ends the pages of a delta
+
+// worst case coding n bytes: runs of one zero and one literal byte
+#define CODEMAX(n) (((n) + 1) / 2 * 3)
+#define PAGEMAX    (2 + CODEMAX(BUSPAGESIZE))
+#define DELTAMIN   32    // about the least a capture changes, sizes the index
+
+// everything but the pages
+struct snap {
+	struct cpu cpu;
+	struct mapperregs regs;
+	uint8_t mirror;
+	struct pads pads;
+	struct sched sched;
+	struct ppu ppu;
+	struct apu apu;       // with its log played out
+};
+
+// a delta sits in the ring as the run length coded xor of the capture
+// before it's snap with the next one's, and the pages that changed, as
+// (index, coded xor) pairs
+struct entry {
+	size_t off;
+	size_t size;
+};
+
+struct rewind {
+	uint8_t *ring;
+	size_t cap;
+	size_t head;           // where the next delta goes
+	struct entry *idx;     // deltas, oldest first
+	size_t maxidx;
+	size_t first;
+	size_t count;
+	uint8_t *scratch;      // a delta being built
+
+	_Bool valid;           // base holds the newest capture
+	struct snap snap;
+	uint8_t base[NPAGES][BUSPAGESIZE];
+};
+
+
+struct rewind *rewindnew(size_t bytes)
+{
+	struct rewind *r = calloc(1, sizeof(*r));
+
+	if (!r)
+		return NULL;
+
+	r->cap = bytes;
+	r->maxidx = bytes / DELTAMIN + 1;
+	r->ring = malloc(r->cap);
+	r->idx = malloc(r->maxidx * sizeof(*r->idx));
+	r->scratch = malloc(CODEMAX(sizeof(struct snap)) + NPAGES * PAGEMAX + 2);
+
+	if (!r->ring || !r->idx || !r->scratch) {
+		rewindfree(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+
+void rewindfree(struct rewind *r)
+{
+	if (!r)
+		return;
+
+	free(r->ring);
+	free(r->idx);
+	free(r->scratch);
+	free(r);
+}
+
+
+void rewindclear(struct rewind *r)
+{
+	r->valid = 0;
+	r->head = 0;
+	r->first = 0;
+	r->count = 0;
+}
+
+
+size_t rewindcount(const struct rewind *r)
+{
+	return r->valid + r->count;
+}
+
+
+size_t rewindsize(const struct rewind *r)
+{
+	size_t n = 0;
+
+	for (size_t i = 0; i < r->count; i++)
+		n += r->idx[(r->first + i) % r->maxidx].size;
+
+	return n;
+}
+
+
+// ram that is shared with forks is taken back, to be written
+static uint8_t *pagemem(struct nemu_machine *m, int i)
+{
+	if (i < RAMPAGES) {
+		ramown(m, i);
+		return m->ram + i * BUSPAGESIZE;
+	}
+	if (i < RAMPAGES + CHRPAGES)
+		return m->cart.chrram + (i - RAMPAGES) * BUSPAGESIZE;
+	if (i < NPAGES - 1)
+		return m->vram + (i - RAMPAGES - CHRPAGES) * BUSPAGESIZE;
+
+	return m->oam;
+}
+
+
+static const uint8_t *pageview(struct nemu_machine *m, int i)
+{
+	return i < RAMPAGES ? ramview(m, i) : pagemem(m, i);
+}
+
+
+// the pages that may have changed since busclean(). ram the bus doesn't
+// map writable can change behind its back, and so can chr ram, those are
+// always candidates, as are the ppu's memories. chr ram is left alone if
+// the cart doesn't use it, the ppu's if there is none.
+static void candidates(struct nemu_machine *m, uint8_t *maybe)
+{
+	uint8_t tracked[RAMPAGES] = { 0 };
+
+	memset(maybe, 0, NPAGES);
+
+	for (int p = 0; p < BUSPAGES; p++) {
+		uint8_t *mem = m->bus.page[p].mem;
+
+		if (mem < m->ram || mem >= m->ram + RAMSIZE)
+			continue;
+
+		int i = (mem - m->ram) / BUSPAGESIZE;
+
+		tracked[i] = 1;
+		if (m->bus.dirty[p >> 3] & (1 << (p & 7)))
+			maybe[i] = 1;
+	}
+
+	for (int i = 0; i < RAMPAGES; i++) {
+		if (!tracked[i])
+			maybe[i] = 1;
+	}
+	if (m->cart.file && !m->cart.chr)
+		memset(maybe + RAMPAGES, 1, CHRPAGES);
+	if (m->ppu.on)
+		memset(maybe + RAMPAGES + CHRPAGES, 1, PPUPAGES);
+}
+
+
+static void snapshot(struct nemu_machine *m, struct snap *s)
+{
+	apusync(m);
+	s->cpu = m->cpu;
+	s->regs = m->cart.regs;
+	s->mirror = m->cart.mirror;
+	s->pads = m->pads;
+	s->sched = m->sched;
+	s->ppu = m->ppu;
+	s->apu = m->apu;
+}
+
+
+// zero runs and literal runs of up to 255 bytes each
+static size_t rle(const uint8_t *x, size_t size, uint8_t *out)
+{
+	size_t n = 0;
+	size_t i = 0;
+
+	while (i < size) {
+		int z = 0, l = 0;
+
+		while (i < size && x[i] == 0 && z < 255) {
+			i++;
+			z++;
+		}
+		while (i + l < size && x[i + l] && l < 255)
+			l++;
+
+		out[n++] = z;
+		out[n++] = l;
+		memcpy(out + n, x + i, l);
+		n += l;
+		i += l;
+	}
+
+	return n;
+}
+
+
+// xor size coded bytes into p, returns the end of the code
+static const uint8_t *unrle(const uint8_t *in, uint8_t *p, size_t size)
+{
+	size_t i = 0;
+
+	while (i < size) {
+		i += *in++;
+		int l = *in++;
+
+		for (int k = 0; k < l; k++)
+			p[i + k] ^= in[k];
+		in += l;
+		i += l;
+	}
+
+	return in;
+}
+
+
+// put a delta at the head of the ring, dropping the oldest ones in its way
+static void push(struct rewind *r, const uint8_t *data, size_t size)
+{
+	if (size > r->cap) {
+		r->count = 0;
+		return;
+	}
+
+	if (r->head + size > r->cap)
+		r->head = 0;
+
+	while (r->count) {
+		const struct entry *e = &r->idx[r->first];
+
+		if (r->count < r->maxidx && (e->off >= r->head + size || e->off + e->size <= r->head))
+			break;
+
+		r->first = (r->first + 1) % r->maxidx;
+		r->count--;
+	}
+
+	memcpy(r->ring + r->head, data, size);
+	r->idx[(r->first + r->count) % r->maxidx] = (struct entry){ r->head, size };
+	r->count++;
+	r->head += size;
+}
+
+
+void rewindcapture(struct rewind *r, struct nemu_machine *m)
+{
+	uint8_t maybe[NPAGES];
+	uint8_t x[BUSPAGESIZE];
+	struct snap now;
+	uint8_t sx[sizeof(now)];
+
+	if (!r->valid) {
+		for (int i = 0; i < NPAGES; i++)
+			memcpy(r->base[i], pageview(m, i), BUSPAGESIZE);
+		snapshot(m, &r->snap);
+		r->valid = 1;
+		busclean(m);
+		return;
+	}
+
+	uint8_t *out = r->scratch;
+
+	// most of the snap stays put between captures, only what moved costs
+	now = r->snap;
+	snapshot(m, &now);
+	for (size_t k = 0; k < sizeof(now); k++)
+		sx[k] = ((uint8_t *)&now)[k] ^ ((uint8_t *)&r->snap)[k];
+	out += rle(sx, sizeof(now), out);
+
+	candidates(m, maybe);
+	for (int i = 0; i < NPAGES; i++) {
+		const uint8_t *live = pageview(m, i);
+
+		if (!maybe[i] || memcmp(live, r->base[i], BUSPAGESIZE) == 0)
+			continue;
+
+		for (int k = 0; k < BUSPAGESIZE; k++)
+			x[k] = live[k] ^ r->base[i][k];
+		memcpy(r->base[i], live, BUSPAGESIZE);
+
+		*out++ = i & 0xFF;
+		*out++ = i >> 8;
+		out += rle(x, BUSPAGESIZE, out);
+	}
+	*out++ = LASTPAGE & 0xFF;
+	*out++ = LASTPAGE >> 8;
+
+	push(r, r->scratch, out - r->scratch);
+	r->snap = now;
+	busclean(m);
+}
+
+
+// put the machine back to the newest capture. if it is already there,
+// that capture is dropped and the one before it restored instead.
+int rewindstep(struct rewind *r, struct nemu_machine *m)
+{
+	uint8_t maybe[NPAGES];
+
+	if (!r->valid)
+		return -1;
+
+	candidates(m, maybe);
+
+	if (m->cpu.clock_count == r->snap.cpu.clock_count) {
+		if (!r->count)
+			return -1;
+
+		size_t newest = (r->first + r->count - 1) % r->maxidx;
+		const struct entry *e = &r->idx[newest];
+		const uint8_t *in = r->ring + e->off;
+
+		in = unrle(in, (uint8_t *)&r->snap, sizeof(r->snap));
+
+		for (;;) {
+			int i = in[0] | in[1] << 8;
+
+			in += 2;
+			if (i == LASTPAGE)
+				break;
+			in = unrle(in, r->base[i], BUSPAGESIZE);
+			maybe[i] = 1;
+		}
+
+		r->head = e->off;
+		r->count--;
+	}
+
+	for (int i = 0; i < NPAGES; i++) {
+		if (maybe[i])
+			memcpy(pagemem(m, i), r->base[i], BUSPAGESIZE);
+	}
+
+	// breakpoints aren't part of the history
+	uint16_t nbreak = m->cpu.nbreak;
+
+	m->cpu = r->snap.cpu;
+	m->cpu.m = m;
+	m->cpu.nbreak = nbreak;
+	m->cart.regs = r->snap.regs;
+	m->cart.mirror = r->snap.mirror;
+	m->pads = r->snap.pads;
+	m->sched = r->snap.sched;
+	m->ppu = r->snap.ppu;
+	m->apu = r->snap.apu;
+	m->apulogn = 0;
+	if (m->cart.hw)
+		m->cart.hw->banks(m);
+
+	// ram changed behind the bus' back
+	for (int i = 0; i < BUSPAGES; i++)
+		bustouch(m, i);
+	busclean(m);
+
+	return 0;
+}
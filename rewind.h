@@ -0,0 +1,23 @@
+#ifndef REWIND_H_
+#define REWIND_H_
+
+#include <stddef.h>
+
+// rewind history. rewindcapture() records the machine, rewindstep() puts
+// it back to the last capture and forgets it, so repeated steps walk
+// backwards. the newest capture is kept whole, older ones as xor deltas to
+// their successor, run length coded, in a ring of fixed size. only pages
+// the bus saw written since the last capture are diffed.
+
+struct nemu_machine;
+struct rewind;
+
+struct rewind *rewindnew(size_t bytes);    // history ring of about bytes, NULL without memory
+void rewindfree(struct rewind *r);
+void rewindclear(struct rewind *r);        // forget everything, after nemu_load_state() say
+void rewindcapture(struct rewind *r, struct nemu_machine *m);
+int rewindstep(struct rewind *r, struct nemu_machine *m);    // 0 or -1 with nothing left
+size_t rewindcount(const struct rewind *r);                  // captures rewindstep() can go to
+size_t rewindsize(const struct rewind *r);                   // bytes of deltas held
+
+#endif // REWIND_H_
@@ -0,0 +1,67 @@
+#include "machine.h"
+#include "sched.h"
+
+static void (*const handler[SCHEDEVENTS])(struct nemu_machine *m) = {
+	[SCHEDINPUT] = inputfeed,
+	[SCHEDPPU]   = ppuevent,
+	[SCHEDAPU]   = apuevent,
+};
+
+
+void schedinit(struct sched *s)
+{
+	for (int i = 0; i < SCHEDEVENTS; i++)
+		s->when[i] = UINT64_MAX;
+	s->next = UINT64_MAX;
+	s->first = 0;
+}
+
+
+// lowest id first on a tie
+static void earliest(struct sched *s)
+{
+	s->next = UINT64_MAX;
+	s->first = 0;
+	for (int i = 0; i < SCHEDEVENTS; i++) {
+		if (s->when[i] < s->next) {
+			s->next = s->when[i];
+			s->first = i;
+		}
+	}
+}
+
+
+void schedat(struct nemu_machine *m, uint8_t id, uint64_t when)
+{
+	struct sched *s = &m->sched;
+
+	s->when[id] = when;
+
+	if (when < s->next || (when == s->next && id < s->first)) {
+		s->next = when;
+		s->first = id;
+	} else if (id == s->first) {
+		earliest(s);
+	}
+
+	// a run in progress stops for it
+	if (when < m->cpu.until) {
+		m->cpu.until = when;
+		m->cpu.pending |= SCHEDLINE;
+	}
+}
+
+
+void schedrun(struct nemu_machine *m)
+{
+	struct sched *s = &m->sched;
+
+	while (s->next <= m->cpu.clock_count) {
+		uint8_t id = s->first;
+
+		// unscheduled before the call, the handler schedules it again
+		s->when[id] = UINT64_MAX;
+		earliest(s);
+		handler[id](m);
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include <stdint.h>
+
+// timed events. a device that does something at a known cycle, a vblank or
+// a timer running out, asks for a call at that clock_count with schedat()
+// instead of being ticked every cycle. cpurun() runs uninterrupted up to
+// the earliest event, and events fire at the first instruction boundary at
+// or after their time, in time order and by id for a tie. there is one
+// slot per id, scheduling an id again moves it. the ids and handlers are
+// fixed (see sched.c), so the times are all a snapshot needs.
+
+enum SCHEDEVENT {
+	SCHEDINPUT,      // the next input event being replayed
+	SCHEDPPU,        // vblank, a sprite 0 hit or a scanline the cart counts
+	SCHEDAPU,        // the frame irq, a dmc fetch or the batch once a frame
+	SCHEDEVENTS,
+};
+
+// there are only ever a few ids, so the earliest is found by looking at
+// them all when it fires or moves later, which beats keeping a heap
+struct sched {
+	uint64_t when[SCHEDEVENTS];    // UINT64_MAX when not scheduled
+	uint64_t next;                 // the earliest of when
+	uint8_t first;                 // its id
+};
+
+struct nemu_machine;
+
+void schedinit(struct sched *s);                                      // nothing scheduled
+void schedat(struct nemu_machine *m, uint8_t id, uint64_t when);     // UINT64_MAX cancels
+void schedrun(struct nemu_machine *m);                               // fire what is due
+
+
+// clock_count of the earliest event, UINT64_MAX if none
+static inline uint64_t schednext(const struct sched *s)
+{
+	return s->next;
+}
+
+#endif // SCHED_H_
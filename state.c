@@ -0,0 +1,585 @@
+#include <errno.h>
+#include <string.h>
+
+#include "machine.h"
+#include "mapper.h"
+#include "state.h"
+
+#define CHUNK(a, b, c, d) ((uint32_t)(a) | (uint32_t)(b) << 8 | (uint32_t)(c) << 16 | (uint32_t)(d) << 24)
+
+#define CHUNKCPU  CHUNK('C', 'P', 'U', ' ')
+#define CHUNKCART CHUNK('C', 'A', 'R', 'T')
+#define CHUNKPADS CHUNK('P', 'A', 'D', 'S')
+#define CHUNKPPU  CHUNK('P', 'P', 'U', ' ')
+#define CHUNKAPU  CHUNK('A', 'P', 'U', ' ')
+#define CHUNKRAM  CHUNK('R', 'A', 'M', ' ')
+#define CHUNKSCHD CHUNK('S', 'C', 'H', 'D')
+#define CHUNKEND  CHUNK('E', 'N', 'D', ' ')
+
+// cursor over the blob. writes past the end are only counted, reads past
+// it set bad.
+struct stream {
+	uint8_t *w;
+	const uint8_t *r;
+	size_t pos;
+	size_t size;
+	_Bool bad;
+};
+
+static const uint8_t zeropage[BUSPAGESIZE];
+
+
+static void put(struct stream *s, const void *data, size_t n)
+{
+	if (s->pos + n <= s->size)
+		memcpy(s->w + s->pos, data, n);
+	s->pos += n;
+}
+
+static void put8(struct stream *s, uint8_t v)
+{
+	put(s, &v, 1);
+}
+
+static void put16(struct stream *s, uint16_t v)
+{
+	put8(s, v);
+	put8(s, v >> 8);
+}
+
+static void put32(struct stream *s, uint32_t v)
+{
+	put16(s, v);
+	put16(s, v >> 16);
+}
+
+static void put64(struct stream *s, uint64_t v)
+{
+	put32(s, v);
+	put32(s, v >> 32);
+}
+
+
+static const uint8_t *get(struct stream *s, size_t n)
+{
+	const uint8_t *p = s->r + s->pos;
+
+	if (s->bad || n > s->size - s->pos) {
+		s->bad = 1;
+		return zeropage;    // at least BUSPAGESIZE of harmless bytes
+	}
+
+	s->pos += n;
+	return p;
+}
+
+static uint8_t get8(struct stream *s)
+{
+	return *get(s, 1);
+}
+
+static uint16_t get16(struct stream *s)
+{
+	uint16_t lo = get8(s);
+	return lo | get8(s) << 8;
+}
+
+static uint32_t get32(struct stream *s)
+{
+	uint32_t lo = get16(s);
+	return lo | (uint32_t)get16(s) << 16;
+}
+
+static uint64_t get64(struct stream *s)
+{
+	uint64_t lo = get32(s);
+	return lo | (uint64_t)get32(s) << 32;
+}
+
+
+// chunks are a tag and a length, the length is patched in once the body
+// is written
+static size_t begin(struct stream *s, uint32_t tag)
+{
+	put32(s, tag);
+	put32(s, 0);
+	return s->pos;
+}
+
+static void end(struct stream *s, size_t start)
+{
+	size_t pos = s->pos;
+
+	s->pos = start - 4;
+	put32(s, pos - start);
+	s->pos = pos;
+}
+
+
+static void putenvelope(struct stream *s, const struct apuenvelope *e)
+{
+	put8(s, e->start);
+	put8(s, e->divider);
+	put8(s, e->decay);
+}
+
+
+static void putpulse(struct stream *s, const struct apupulse *p)
+{
+	put8(s, p->ctrl);
+	put8(s, p->sweep);
+	put16(s, p->period);
+	put8(s, p->length);
+	put8(s, p->step);
+	putenvelope(s, &p->env);
+	put8(s, p->sweepdivider);
+	put8(s, p->sweepreload);
+	put8(s, p->out);
+	put64(s, p->next);
+}
+
+
+static void puttriangle(struct stream *s, const struct aputriangle *t)
+{
+	put8(s, t->ctrl);
+	put16(s, t->period);
+	put8(s, t->length);
+	put8(s, t->linear);
+	put8(s, t->reload);
+	put8(s, t->step);
+	put8(s, t->out);
+	put64(s, t->next);
+}
+
+
+static void putnoise(struct stream *s, const struct apunoise *z)
+{
+	put8(s, z->ctrl);
+	put8(s, z->mode);
+	put16(s, z->lfsr);
+	put8(s, z->length);
+	putenvelope(s, &z->env);
+	put8(s, z->out);
+	put64(s, z->next);
+}
+
+
+static void putdmc(struct stream *s, const struct apudmc *d)
+{
+	put8(s, d->ctrl);
+	put8(s, d->start);
+	put8(s, d->len);
+	put16(s, d->addr);
+	put16(s, d->left);
+	put8(s, d->buf);
+	put8(s, d->full);
+	put64(s, d->clock);
+	put8(s, d->rate);
+	put8(s, d->level);
+	put8(s, d->shift);
+	put8(s, d->bits);
+	put64(s, d->next);
+}
+
+
+size_t nemu_save_state(struct nemu_machine *m, uint8_t *buf, size_t size)
+{
+	struct stream s = { .w = buf, .size = size };
+	const struct cpu *cpu = &m->cpu;
+	const struct cart *c = &m->cart;
+	uint8_t used[BUSPAGES / 8] = { 0 };
+	size_t chunk;
+
+	// the ppu only catches up when it has to and wakes up earlier for a
+	// loop polling it. bring it level and forget the poll, as its own
+	// event does, so the same moment always saves the same bytes
+	if (m->ppu.on)
+		ppuevent(m);
+	// and play out the apu's log, it isn't saved
+	apusync(m);
+
+	put(&s, "NEMU", 4);
+	put16(&s, NEMU_STATEVERSION);
+
+	chunk = begin(&s, CHUNKCPU);
+	put8(&s, cpu->a);
+	put8(&s, cpu->x);
+	put8(&s, cpu->y);
+	put8(&s, cpu->stkp);
+	put16(&s, cpu->pc);
+	put8(&s, cpu->status);
+	put16(&s, cpu->cycles);
+	put8(&s, cpu->pending);
+	put8(&s, cpu->irq);
+	put16(&s, cpu->stall);
+	put8(&s, cpu->stallalign);
+	put64(&s, cpu->clock_count);
+	put64(&s, cpu->instructions);
+	end(&s, chunk);
+
+	if (c->file) {
+		chunk = begin(&s, CHUNKCART);
+		put16(&s, c->mapper);
+		put8(&s, c->mirror);
+		put(&s, c->regs.reg, sizeof(c->regs.reg));
+		put8(&s, c->regs.select);
+		put8(&s, c->regs.shift);
+		put8(&s, c->regs.nshift);
+		put8(&s, c->regs.control);
+		put8(&s, c->regs.irqlatch);
+		put8(&s, c->regs.irqcounter);
+		put8(&s, c->regs.irqreload);
+		put8(&s, c->regs.irqenable);
+		put8(&s, c->chr == NULL);
+		if (!c->chr)
+			put(&s, c->chrram, CARTCHRRAM);
+		end(&s, chunk);
+	}
+
+	chunk = begin(&s, CHUNKPADS);
+	put(&s, m->pads.buttons, 2);
+	put(&s, m->pads.shift, 2);
+	put8(&s, m->pads.strobe);
+	end(&s, chunk);
+
+	if (m->ppu.on) {
+		const struct ppu *p = &m->ppu;
+
+		chunk = begin(&s, CHUNKPPU);
+		put8(&s, p->ctrl);
+		put8(&s, p->mask);
+		put8(&s, p->status);
+		put8(&s, p->oamaddr);
+		put16(&s, p->v);
+		put16(&s, p->t);
+		put8(&s, p->x);
+		put8(&s, p->w);
+		put8(&s, p->readbuf);
+		put8(&s, p->latch);
+		put(&s, p->palette, sizeof(p->palette));
+		put64(&s, p->dot);
+		put64(&s, p->frame);
+		put16(&s, p->line);
+		put16(&s, p->col);
+		put16(&s, p->hitcol);
+		put8(&s, p->odd);
+		put(&s, m->oam, sizeof(m->oam));
+		put(&s, m->vram, sizeof(m->vram));
+		end(&s, chunk);
+	}
+
+	if (m->apu.on) {
+		const struct apu *a = &m->apu;
+
+		chunk = begin(&s, CHUNKAPU);
+		for (int i = 0; i < 2; i++)
+			putpulse(&s, &a->pulse[i]);
+		puttriangle(&s, &a->triangle);
+		putnoise(&s, &a->noise);
+		putdmc(&s, &a->dmc);
+		put8(&s, a->enable);
+		put8(&s, a->mode);
+		put8(&s, a->seqstep);
+		put64(&s, a->seqstart);
+		put8(&s, a->inhibit);
+		put8(&s, a->frameirq);
+		put8(&s, a->dmcirq);
+		put64(&s, a->irqat);
+		put64(&s, a->synthat);
+		put64(&s, a->clock);
+		end(&s, chunk);
+	}
+
+	chunk = begin(&s, CHUNKSCHD);
+	put8(&s, SCHEDEVENTS);
+	for (int i = 0; i < SCHEDEVENTS; i++)
+		put64(&s, m->sched.when[i]);
+	end(&s, chunk);
+
+	// a bitmap of the pages that follow, all others are zero
+	for (int i = 0; i < RAMSIZE / BUSPAGESIZE; i++) {
+		if (memcmp(ramview(m, i), zeropage, BUSPAGESIZE) != 0)
+			used[i >> 3] |= 1 << (i & 7);
+	}
+
+	chunk = begin(&s, CHUNKRAM);
+	put(&s, used, sizeof(used));
+	for (int i = 0; i < RAMSIZE / BUSPAGESIZE; i++) {
+		if (used[i >> 3] & (1 << (i & 7)))
+			put(&s, ramview(m, i), BUSPAGESIZE);
+	}
+	end(&s, chunk);
+
+	chunk = begin(&s, CHUNKEND);
+	end(&s, chunk);
+
+	return s.pos;
+}
+
+
+static void loadcpu(struct nemu_machine *m, struct stream *s)
+{
+	struct cpu *cpu = &m->cpu;
+
+	cpu->a = get8(s);
+	cpu->x = get8(s);
+	cpu->y = get8(s);
+	cpu->stkp = get8(s);
+	cpu->pc = get16(s);
+	cpu->status = get8(s);
+	cpu->cycles = get16(s);
+	cpu->pending = get8(s);
+	cpu->irq = get8(s);
+	cpu->stall = get16(s);
+	cpu->stallalign = get8(s);
+	cpu->clock_count = get64(s);
+	cpu->instructions = get64(s);
+}
+
+
+static void loadcart(struct nemu_machine *m, struct stream *s)
+{
+	struct cart *c = &m->cart;
+
+	if (!c->file || get16(s) != c->mapper) {
+		s->bad = 1;
+		return;
+	}
+
+	uint8_t mirror = get8(s);
+
+	if (mirror > MIRRORSINGLEHI) {
+		s->bad = 1;
+		return;
+	}
+	c->mirror = mirror;
+	memcpy(c->regs.reg, get(s, sizeof(c->regs.reg)), sizeof(c->regs.reg));
+	c->regs.select = get8(s);
+	c->regs.shift = get8(s);
+	c->regs.nshift = get8(s);
+	c->regs.control = get8(s);
+	c->regs.irqlatch = get8(s);
+	c->regs.irqcounter = get8(s);
+	c->regs.irqreload = get8(s);
+	c->regs.irqenable = get8(s);
+	if (get8(s)) {
+		for (size_t i = 0; i < CARTCHRRAM; i += BUSPAGESIZE)
+			memcpy(c->chrram + i, get(s, BUSPAGESIZE), BUSPAGESIZE);
+	}
+
+	if (!s->bad)
+		c->hw->banks(m);
+}
+
+
+static void loadpads(struct nemu_machine *m, struct stream *s)
+{
+	memcpy(m->pads.buttons, get(s, 2), 2);
+	memcpy(m->pads.shift, get(s, 2), 2);
+	m->pads.strobe = get8(s);
+}
+
+
+static void loadppu(struct nemu_machine *m, struct stream *s)
+{
+	struct ppu *p = &m->ppu;
+
+	if (!p->on) {
+		s->bad = 1;
+		return;
+	}
+
+	p->ctrl = get8(s);
+	p->mask = get8(s);
+	p->status = get8(s);
+	p->oamaddr = get8(s);
+	p->v = get16(s);
+	p->t = get16(s);
+	p->x = get8(s) & 7;
+	p->w = get8(s);
+	p->readbuf = get8(s);
+	p->latch = get8(s);
+	memcpy(p->palette, get(s, sizeof(p->palette)), sizeof(p->palette));
+	p->dot = get64(s);
+	p->frame = get64(s);
+	uint16_t line = get16(s);
+	uint16_t col = get16(s);
+	uint16_t hitcol = get16(s);
+
+	// run() and newline() only ever find their way around a real frame
+	if (line >= PPULINES || col >= PPUDOTS || hitcol > PPUDOTS) {
+		s->bad = 1;
+		return;
+	}
+	p->line = line;
+	p->col = col;
+	p->hitcol = hitcol;
+	p->odd = get8(s);
+	p->polled = 0;
+	memcpy(m->oam, get(s, sizeof(m->oam)), sizeof(m->oam));
+	for (size_t i = 0; i < PPUVRAM; i += BUSPAGESIZE)
+		memcpy(m->vram + i, get(s, BUSPAGESIZE), BUSPAGESIZE);
+}
+
+
+static void getenvelope(struct stream *s, struct apuenvelope *e)
+{
+	e->start = get8(s);
+	e->divider = get8(s);
+	e->decay = get8(s);
+}
+
+
+static void loadapu(struct nemu_machine *m, struct stream *s)
+{
+	struct apu *a = &m->apu;
+
+	if (!a->on) {
+		s->bad = 1;
+		return;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		struct apupulse *p = &a->pulse[i];
+
+		p->ctrl = get8(s);
+		p->sweep = get8(s);
+		p->period = get16(s);
+		p->length = get8(s);
+		p->step = get8(s);
+		getenvelope(s, &p->env);
+		p->sweepdivider = get8(s);
+		p->sweepreload = get8(s);
+		p->out = get8(s);
+		p->next = get64(s);
+	}
+
+	struct aputriangle *t = &a->triangle;
+
+	t->ctrl = get8(s);
+	t->period = get16(s);
+	t->length = get8(s);
+	t->linear = get8(s);
+	t->reload = get8(s);
+	t->step = get8(s);
+	t->out = get8(s);
+	t->next = get64(s);
+
+	struct apunoise *z = &a->noise;
+
+	z->ctrl = get8(s);
+	z->mode = get8(s);
+	z->lfsr = get16(s);
+	z->length = get8(s);
+	getenvelope(s, &z->env);
+	z->out = get8(s);
+	z->next = get64(s);
+
+	struct apudmc *d = &a->dmc;
+
+	d->ctrl = get8(s);
+	d->start = get8(s);
+	d->len = get8(s);
+	d->addr = get16(s);
+	d->left = get16(s);
+	d->buf = get8(s);
+	d->full = get8(s);
+	d->clock = get64(s);
+	d->rate = get8(s);
+	d->level = get8(s);
+	d->shift = get8(s);
+	d->bits = get8(s);
+	d->next = get64(s);
+
+	a->enable = get8(s);
+	a->mode = get8(s);
+	a->seqstep = get8(s);
+	a->seqstart = get64(s);
+	a->inhibit = get8(s);
+	a->frameirq = get8(s);
+	a->dmcirq = get8(s);
+	a->irqat = get64(s);
+	a->synthat = get64(s);
+	a->clock = get64(s);
+	m->apulogn = 0;
+}
+
+
+// ids past the ones this version has are dropped
+static void loadsched(struct nemu_machine *m, struct stream *s)
+{
+	uint8_t n = get8(s);
+
+	schedinit(&m->sched);
+	for (int i = 0; i < n; i++) {
+		uint64_t when = get64(s);
+
+		if (i < SCHEDEVENTS && !s->bad)
+			schedat(m, i, when);
+	}
+}
+
+
+static void loadram(struct nemu_machine *m, struct stream *s)
+{
+	uint8_t used[BUSPAGES / 8];
+
+	memcpy(used, get(s, sizeof(used)), sizeof(used));
+
+	for (int i = 0; i < RAMSIZE / BUSPAGESIZE; i++) {
+		ramown(m, i);
+		if (used[i >> 3] & (1 << (i & 7)))
+			memcpy(m->ram + i * BUSPAGESIZE, get(s, BUSPAGESIZE), BUSPAGESIZE);
+		else
+			memset(m->ram + i * BUSPAGESIZE, 0, BUSPAGESIZE);
+	}
+}
+
+
+// the blob is checked chunk by chunk as it is applied, a bad one can leave
+// the machine half loaded
+int nemu_load_state(struct nemu_machine *m, const uint8_t *buf, size_t size)
+{
+	struct stream s = { .r = buf, .size = size };
+
+	if (memcmp(get(&s, 4), "NEMU", 4) != 0 || get16(&s) != NEMU_STATEVERSION) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (;;) {
+		uint32_t tag = get32(&s);
+		uint32_t len = get32(&s);
+		size_t start = s.pos;
+
+		if (s.bad || len > size - start)
+			break;
+
+		// chunks this version doesn't know are skipped
+		struct stream body = { .r = buf + start, .size = len };
+
+		switch (tag) {
+		case CHUNKCPU:  loadcpu(m, &body); break;
+		case CHUNKCART: loadcart(m, &body); break;
+		case CHUNKPADS: loadpads(m, &body); break;
+		case CHUNKPPU:  loadppu(m, &body); break;
+		case CHUNKAPU:  loadapu(m, &body); break;
+		case CHUNKRAM:  loadram(m, &body); break;
+		case CHUNKSCHD: loadsched(m, &body); break;
+		}
+
+		if (body.bad)
+			break;
+		if (tag == CHUNKEND) {
+			// ram changed behind the bus' back
+			for (int i = 0; i < BUSPAGES; i++)
+				bustouch(m, i);
+			return 0;
+		}
+
+		s.pos = start + len;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
@@ -0,0 +1,22 @@
+#ifndef STATE_H_
+#define STATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// machine snapshots. a state is a versioned little endian blob of tagged
+// chunks: the cpu, the cart's mapper registers and chr ram, the pads, the
+// ppu with its memories, the apu, the scheduled events and the ram pages
+// that aren't all zero. the memory map itself and the cart's rom are not in
+// it, load a state into a machine set up with the same image.
+
+#define NEMU_STATEVERSION 3
+
+struct nemu_machine;
+
+// returns the size of the state. it is only written if that fits in size,
+// so a call with size 0 tells how big buf has to be.
+size_t nemu_save_state(struct nemu_machine *m, uint8_t *buf, size_t size);
+int nemu_load_state(struct nemu_machine *m, const uint8_t *buf, size_t size);    // 0 or -1 with errno set
+
+#endif // STATE_H_
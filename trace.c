@@ -0,0 +1,175 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define RECORDSIZE 18    // on disk
+
+
+struct trace *tracenew(size_t records)
+{
+	struct trace *t = calloc(1, sizeof(*t));
+	size_t n = 1;
+
+	if (!t)
+		return NULL;
+
+	while (n < records)
+		n <<= 1;
+
+	t->mask = n - 1;
+	atomic_init(&t->head, 0);
+	if (!(t->rec = malloc(n * sizeof(*t->rec)))) {
+		free(t);
+		return NULL;
+	}
+
+	return t;
+}
+
+
+void tracefree(struct trace *t)
+{
+	if (!t)
+		return;
+
+	free(t->rec);
+	free(t);
+}
+
+
+void traceclear(struct trace *t)
+{
+	atomic_store_explicit(&t->head, 0, memory_order_release);
+}
+
+
+// the writer may lap us while we copy, whatever it got to is dropped
+size_t tracecopy(struct trace *t, struct tracerecord *out, size_t max)
+{
+	uint64_t head = atomic_load_explicit(&t->head, memory_order_acquire);
+	uint64_t n = head < t->mask + 1 ? head : t->mask + 1;
+
+	if (n > max)
+		n = max;
+
+	uint64_t first = head - n;
+
+	for (uint64_t i = 0; i < n; i++)
+		out[i] = t->rec[(first + i) & t->mask];
+
+	uint64_t now = atomic_load_explicit(&t->head, memory_order_acquire);
+	uint64_t lost = now - first > t->mask + 1 ? now - first - (t->mask + 1) : 0;
+
+	if (lost >= n)
+		return 0;
+
+	memmove(out, out + lost, (n - lost) * sizeof(*out));
+	return n - lost;
+}
+
+
+static void le(uint8_t *p, uint64_t v, int n)
+{
+	for (int i = 0; i < n; i++)
+		p[i] = v >> (8 * i);
+}
+
+static uint64_t unle(const uint8_t *p, int n)
+{
+	uint64_t v = 0;
+
+	for (int i = n - 1; i >= 0; i--)
+		v = v << 8 | p[i];
+	return v;
+}
+
+
+// "NEMUTRC", a version and the record count, then the records: clock, pc,
+// opcode, the two operand bytes, a, x, y, s and p, all little endian
+int tracesave(struct trace *t, const char *path)
+{
+	struct tracerecord *rec = malloc((t->mask + 1) * sizeof(*rec));
+	uint8_t hdr[8 + 2 + 4];
+	uint8_t e[RECORDSIZE];
+	FILE *f;
+
+	if (!rec)
+		return -1;
+	if (!(f = fopen(path, "wb"))) {
+		free(rec);
+		return -1;
+	}
+
+	size_t n = tracecopy(t, rec, t->mask + 1);
+
+	memcpy(hdr, "NEMUTRC", 8);
+	le(hdr + 8, 1, 2);
+	le(hdr + 10, n, 4);
+	fwrite(hdr, 1, sizeof(hdr), f);
+
+	for (size_t i = 0; i < n; i++) {
+		le(e, rec[i].clock, 8);
+		le(e + 8, rec[i].pc, 2);
+		e[10] = rec[i].opcode;
+		e[11] = rec[i].operand[0];
+		e[12] = rec[i].operand[1];
+		e[13] = rec[i].a;
+		e[14] = rec[i].x;
+		e[15] = rec[i].y;
+		e[16] = rec[i].s;
+		e[17] = rec[i].p;
+		fwrite(e, 1, sizeof(e), f);
+	}
+	free(rec);
+
+	if (ferror(f)) {
+		fclose(f);
+		return -1;
+	}
+	return fclose(f) == 0 ? 0 : -1;
+}
+
+
+struct tracerecord *traceload(const char *path, size_t *n)
+{
+	FILE *f = fopen(path, "rb");
+	struct tracerecord *rec;
+	uint8_t hdr[8 + 2 + 4];
+	uint8_t e[RECORDSIZE];
+
+	if (!f)
+		return NULL;
+
+	if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr) || memcmp(hdr, "NEMUTRC", 8) != 0 ||
+	    unle(hdr + 8, 2) != 1) {
+		fclose(f);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	*n = unle(hdr + 10, 4);
+	if (!(rec = malloc((*n ? *n : 1) * sizeof(*rec)))) {
+		fclose(f);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < *n; i++) {
+		if (fread(e, 1, sizeof(e), f) != sizeof(e)) {
+			fclose(f);
+			free(rec);
+			errno = EINVAL;
+			return NULL;
+		}
+		rec[i] = (struct tracerecord){
+			.clock = unle(e, 8), .pc = unle(e + 8, 2), .opcode = e[10],
+			.operand = { e[11], e[12] },
+			.a = e[13], .x = e[14], .y = e[15], .s = e[16], .p = e[17],
+		};
+	}
+
+	fclose(f);
+	return rec;
+}
@@ -0,0 +1,47 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// execution trace. built with -DNEMU_TRACE, the cpu appends a record per
+// instruction to the ring in m->trace when there is one; cpurun() then
+// steps through the table core, so the fused cores carry no hook and pay
+// one test per call. without the define nothing is compiled in at all.
+// the ring keeps the newest records. there is one writer, the cpu, and
+// head is published with release order, so another thread can read it
+// without locking the machine (see tracecopy()). tracedump turns a saved
+// trace into nestest style text.
+
+struct tracerecord {
+	uint64_t clock;        // clock_count before the instruction
+	uint16_t pc;
+	uint8_t opcode;
+	uint8_t operand[2];    // the bytes after the opcode
+	uint8_t a, x, y, s, p;
+};
+
+struct trace {
+	struct tracerecord *rec;
+	size_t mask;                  // records - 1
+	_Atomic uint64_t head;        // records ever added
+};
+
+struct trace *tracenew(size_t records);    // rounded up to a power of two, NULL without memory
+void tracefree(struct trace *t);
+void traceclear(struct trace *t);
+size_t tracecopy(struct trace *t, struct tracerecord *out, size_t max);    // the newest, oldest first
+int tracesave(struct trace *t, const char *path);     // 0 or -1 with errno set
+struct tracerecord *traceload(const char *path, size_t *n);    // malloced, NULL with errno set
+
+
+static inline void traceadd(struct trace *t, const struct tracerecord *r)
+{
+	uint64_t head = atomic_load_explicit(&t->head, memory_order_relaxed);
+
+	t->rec[head & t->mask] = *r;
+	atomic_store_explicit(&t->head, head + 1, memory_order_release);
+}
+
+#endif // TRACE_H_
@@ -0,0 +1,102 @@
+// prints a trace saved with nemu -t as nestest style text, one line per
+// instruction:
+//
+//   C000  4C F5 C5  JMP $C5F5       A:00 X:00 Y:00 P:24 SP:FD CYC:7
+//
+//   tracedump [-n last] trace
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "trace.h"
+
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: tracedump [-n last] trace\n");
+	exit(1);
+}
+
+
+// the operand in assembler syntax
+static void operand(char *buf, size_t size, const struct tracerecord *r)
+{
+	const char *mode = lookup[r->opcode].mode;
+	uint16_t abs = r->operand[0] | r->operand[1] << 8;
+	uint8_t zp = r->operand[0];
+
+	if (strcmp(mode, "IMP") == 0) {
+		// the shifts and rotates work on a
+		uint8_t op = r->opcode;
+		snprintf(buf, size, "%s", op == 0x0A || op == 0x2A || op == 0x4A || op == 0x6A ? "A" : "");
+	} else if (strcmp(mode, "IMM") == 0) {
+		snprintf(buf, size, "#$%02X", zp);
+	} else if (strcmp(mode, "ZP0") == 0) {
+		snprintf(buf, size, "$%02X", zp);
+	} else if (strcmp(mode, "ZPX") == 0) {
+		snprintf(buf, size, "$%02X,X", zp);
+	} else if (strcmp(mode, "ZPY") == 0) {
+		snprintf(buf, size, "$%02X,Y", zp);
+	} else if (strcmp(mode, "REL") == 0) {
+		snprintf(buf, size, "$%04X", (uint16_t)(r->pc + 2 + (int8_t)zp));
+	} else if (strcmp(mode, "ABS") == 0) {
+		snprintf(buf, size, "$%04X", abs);
+	} else if (strcmp(mode, "ABX") == 0) {
+		snprintf(buf, size, "$%04X,X", abs);
+	} else if (strcmp(mode, "ABY") == 0) {
+		snprintf(buf, size, "$%04X,Y", abs);
+	} else if (strcmp(mode, "IND") == 0) {
+		snprintf(buf, size, "($%04X)", abs);
+	} else if (strcmp(mode, "IZX") == 0) {
+		snprintf(buf, size, "($%02X,X)", zp);
+	} else {
+		snprintf(buf, size, "($%02X),Y", zp);
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct tracerecord *rec;
+	size_t n, first = 0, last = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		if (opt == 'n')
+			last = strtoul(optarg, NULL, 0);
+		else
+			usage();
+	}
+	if (optind != argc - 1)
+		usage();
+
+	if (!(rec = traceload(argv[optind], &n))) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+
+	if (last && last < n)
+		first = n - last;
+
+	for (size_t i = first; i < n; i++) {
+		const struct tracerecord *r = &rec[i];
+		uint8_t len = cpulen(r->opcode);
+		char bytes[9], text[16];
+
+		snprintf(bytes, sizeof(bytes), "%02X", r->opcode);
+		for (int k = 1; k < len; k++)
+			snprintf(bytes + 3 * k - 1, sizeof(bytes) - (3 * k - 1), " %02X", r->operand[k - 1]);
+		operand(text, sizeof(text), r);
+
+		printf("%04X  %-8s  %s %-12s A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu\n",
+		       r->pc, bytes, lookup[r->opcode].name, text,
+		       r->a, r->x, r->y, r->p, r->s, (unsigned long long)r->clock);
+	}
+
+	free(rec);
+	return 0;
+}